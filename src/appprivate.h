@@ -19,18 +19,50 @@
 #include <gtk/gtk.h>
 #include <webmessage.h>
 
+typedef struct _AppQueue AppQueue;
 typedef struct _AppServer AppServer;
 
 #if __cplusplus
 extern "C" {
 #endif // __cplusplus
 
+  struct _AppQueue
+  {
+    GMutex lock;
+    guint drop_count;
+    gint64 drop_next;
+    gint64 interval_end;
+    gint64 last_avg;
+    gint64 last_max;
+    gint64 last_min;
+    gint64 max_delay;
+    gint64 min_delay;
+    guint n_samples;
+    guint n_shed;
+    guint overloaded;
+    gint64 sum_delay;
+  };
+
   struct _AppServer
   {
     GApplication parent;
 
     /* private */
+    gint keepalive_timeout;
+    gint max_connections;
+    gint max_header_bytes;
+    gint max_header_count;
+    gint max_header_length;
+    gint max_pipelined;
+    gint max_queued_requests;
+    gint max_request_line;
+    gint max_requests;
+    AppQueue queue;
+    gint queue_interval;
+    gint queue_target;
+    guint queued;
     GHashTable* servers;
+    gboolean shed_connections;
     GThreadPool* thread_pool;
   };
 
@@ -16,7 +16,12 @@
  */
 #include <config.h>
 #include <appprivate.h>
+#include <fcntl.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <webmessagefields.h>
+#include <webmessagemethods.h>
 
 G_GNUC_INTERNAL GResource* appresource_get_resource (void) G_GNUC_CONST;
 #define g_string_append_static(gstr,static_) g_string_append_len ((gstr), (static_), G_N_ELEMENTS ((static_)) - 1)
@@ -26,11 +31,20 @@ G_GNUC_INTERNAL GResource* appresource_get_resource (void) G_GNUC_CONST;
 #define _g_object_unref0(var) ((var == NULL) ? NULL : (var = (g_object_unref (var), NULL)))
 #define _g_string_unref0(var) ((var == NULL) ? NULL : (var = (g_string_free (var, TRUE), NULL)))
 #define RESROOT "/org/hck/webserver"
+#define RANGES_MAX (32)
 static gboolean _hierarchy (GFile* target, GFile* root) G_GNUC_PURE;
 static gboolean _hierarchy_inner (GFile* target, GFile* root) G_GNUC_PURE;
+static gint64 _http_date (const gchar* value);
 static gboolean _icon_source (gpointer data);
+static gboolean _if_range (WebMessageHeaders* request, const gchar* etag, const gchar* modified);
+static gboolean _not_modified (WebMessage* message, WebMessageHeaders* request, const gchar* etag, gint64 mtime);
+static const gchar* _param (WebArena* arena, const gchar* query, const gchar* key);
+static void _query_check (const gchar* query, GError** error);
+static gboolean _ranges (WebMessage* message, WebMessageHeaders* request, WebMessageHeaders* response, WebMessageBody* body, goffset size, const gchar* content_type);
 static void _root (AppServer* self, WebMessage* message, GFile* root, GError** error);
 static void _status (WebMessage* message, WebStatusCode status_code, const gchar* description);
+static gchar* _unescape (WebArena* arena, const gchar* value, gsize length);
+static void _validators (GFileInfo* info, gchar** etag, gchar** modified, gint64* mtime);
 
 void _app_process (AppServer* self, WebMessage* message, GFile* root)
 {
@@ -96,6 +110,32 @@ static gboolean _hierarchy_inner (GFile* target, GFile* root)
     }
 }
 
+static gint64 _http_date (const gchar* value)
+{
+  static const gchar months [12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec", };
+  GDateTime* datetime = NULL;
+  gchar month [4] = {0};
+  gint day, year, hour, minute, second, i;
+  gint64 unix_ = -1;
+
+  /* only the IMF-fixdate form is understood; obsolete
+   * forms make the caller ignore the precondition */
+  if (sscanf (value, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &day, month, &year, &hour, &minute, &second) != 6)
+    return -1;
+
+  for (i = 0; i < G_N_ELEMENTS (months); ++i)
+  if (strcmp (month, months [i]) == 0)
+    {
+      if ((datetime = g_date_time_new_utc (year, i + 1, day, hour, minute, second)) != NULL)
+        {
+          unix_ = g_date_time_to_unix (datetime);
+          g_date_time_unref (datetime);
+        }
+      break;
+    }
+return unix_;
+}
+
 static gboolean _icon_source (gpointer data)
 {
   typedef char linecnt [__LINE__ + 1];
@@ -139,10 +179,216 @@ static gboolean _icon_source (gpointer data)
 return (g_atomic_int_set (done, TRUE), G_SOURCE_REMOVE);
 }
 
+static gboolean _if_range (WebMessageHeaders* request, const gchar* etag, const gchar* modified)
+{
+  gboolean match = FALSE;
+  const gchar* value = NULL;
+
+  if ((value = web_message_headers_get_one (request, WEB_MESSAGE_FIELD_IF_RANGE)) == NULL)
+    return TRUE;
+  else
+    {
+      /* If-Range only honours strong validators: an exact entity tag
+       * or the very same date we would send as Last-Modified */
+      if (g_str_has_prefix (value, "W/"))
+        match = FALSE;
+      else if (value [0] == '"')
+        match = etag != NULL && g_str_equal (value, etag);
+      else
+        match = modified != NULL && g_str_equal (value, modified);
+    }
+return match;
+}
+
+static gboolean _not_modified (WebMessage* message, WebMessageHeaders* request, const gchar* etag, gint64 mtime)
+{
+  const gchar* method = web_message_get_method (message);
+  const gchar* tag = NULL;
+  gboolean match = FALSE;
+  const gchar* value = NULL;
+  GList* list = NULL;
+  gint64 since = -1;
+
+  if (g_str_equal (method, WEB_MESSAGE_METHOD_GET) == FALSE
+   && g_str_equal (method, WEB_MESSAGE_METHOD_HEAD) == FALSE)
+    return FALSE;
+
+  /* If-None-Match takes precedence and uses the weak comparison,
+   * If-Modified-Since is only looked at when it is absent */
+  if ((list = web_message_headers_get_list (request, WEB_MESSAGE_FIELD_IF_NONE_MATCH)) != NULL)
+    {
+      for (; list && !match; list = list->next)
+        {
+          tag = list->data;
+
+          if (g_str_equal (tag, "*"))
+            match = TRUE;
+          else if (etag != NULL)
+            {
+              tag = g_str_has_prefix (tag, "W/") == FALSE ? tag : tag + 2;
+              match = g_str_equal (tag, g_str_has_prefix (etag, "W/") == FALSE ? etag : etag + 2);
+            }
+        }
+    }
+  else if (mtime >= 0 && (value = web_message_headers_get_one (request, WEB_MESSAGE_FIELD_IF_MODIFIED_SINCE)) != NULL)
+    {
+      if ((since = _http_date (value)) >= 0)
+        match = mtime <= since;
+    }
+
+  if (match)
+    web_message_set_status (message, WEB_STATUS_CODE_NOT_MODIFIED);
+return match;
+}
+
+static const gchar* _param (WebArena* arena, const gchar* query, const gchar* key)
+{
+  const gchar *element, *next, *equal;
+  const gchar* value = NULL;
+  gsize keysz, length;
+  gchar* name = NULL;
+
+  /* parameters are looked up straight from the query string and
+   * decoded into the message's arena; as with g_uri_parse_params ()
+   * the last of several repeated ones wins */
+  for (element = query; element != NULL && element [0] != 0; element = next)
+    {
+      if ((next = strchr (element, '&')) != NULL)
+        length = (next++) - element;
+      else
+        length = strlen (element);
+
+      if ((equal = memchr (element, '=', length)) != NULL)
+        {
+          keysz = equal - element;
+          name = _unescape (arena, element, keysz);
+
+          if (g_str_equal (name, key))
+            value = _unescape (arena, equal + 1, length - keysz - 1);
+        }
+    }
+return value;
+}
+
+static void _query_check (const gchar* query, GError** error)
+{
+  const gchar* p;
+
+  for (p = query; (p = strchr (p, '%')) != NULL; p += 3)
+    {
+      if (!g_ascii_isxdigit (p [1]) || !g_ascii_isxdigit (p [2]))
+        {
+          g_set_error_literal (error, G_URI_ERROR, G_URI_ERROR_FAILED, _("Invalid %-encoding in URI"));
+          break;
+        }
+    }
+}
+
+static gboolean _ranges (WebMessage* message, WebMessageHeaders* request, WebMessageHeaders* response, WebMessageBody* body, goffset size, const gchar* content_type)
+{
+  WebMessageRange ranges [RANGES_MAX];
+  WebMessageRange* range = NULL;
+  GList* list = NULL;
+  guint i, n_ranges = 0;
+  goffset begin, end;
+
+  if ((list = web_message_headers_get_ranges (request)) == NULL)
+    return FALSE;
+  if (g_list_length (list) > RANGES_MAX)
+    return FALSE;
+
+  for (; list; list = list->next)
+    {
+      range = list->data;
+
+      if (range->begin_offset < 0)
+        {
+          if (range->end_offset == 0)
+            continue;
+
+          begin = MAX (0, size - range->end_offset);
+          end = size - 1;
+        }
+      else
+        {
+          if (range->end_offset >= 0 && range->end_offset < range->begin_offset)
+            return FALSE;
+          if (range->begin_offset >= size)
+            continue;
+
+          begin = range->begin_offset;
+          end = (range->end_offset < 0 || range->end_offset >= size) ? size - 1 : range->end_offset;
+        }
+
+      ranges [n_ranges].begin_offset = begin;
+      ranges [n_ranges].end_offset = end;
+      ++n_ranges;
+    }
+
+  if (n_ranges == 0)
+    {
+      web_message_set_status (message, WEB_STATUS_CODE_RANGE_NO_SATISFIABLE);
+      web_message_headers_set_content_length (response, 0);
+      web_message_headers_set_content_range (response, -1, -1, size);
+    }
+  else if (n_ranges == 1)
+    {
+      begin = ranges [0].begin_offset;
+      end = ranges [0].end_offset;
+
+      web_message_set_status (message, WEB_STATUS_CODE_PARTIAL_CONTENT);
+      web_message_body_add_file (body, begin, end - begin + 1);
+      web_message_headers_set_content_length (response, end - begin + 1);
+      web_message_headers_set_content_range (response, begin, end, size);
+      web_message_headers_set_content_type (response, content_type);
+    }
+  else
+    {
+      GBytes* bytes = NULL;
+      gchar* boundary = NULL;
+      gchar* part = NULL;
+      gsize length = 0;
+      gsize total = 0;
+
+      boundary = g_strdup_printf ("%08x%08x", g_random_int (), g_random_int ());
+
+      /* every part header is a small in-memory chunk between file
+       * chunks, so the parts themselves still go out through sendfile() */
+      for (i = 0; i < n_ranges; ++i)
+        {
+          begin = ranges [i].begin_offset;
+          end = ranges [i].end_offset;
+
+          part = g_strdup_printf ("\r\n--%s\r\n"
+                                  "Content-Type: %s\r\n"
+                                  "Content-Range: bytes %" G_GINT64_FORMAT "-%" G_GINT64_FORMAT "/%" G_GINT64_FORMAT "\r\n"
+                                  "\r\n", boundary, content_type, begin, end, size);
+          bytes = g_bytes_new_take (part, length = strlen (part));
+          total += length + (end - begin + 1);
+
+          web_message_body_add_bytes (body, bytes);
+          web_message_body_add_file (body, begin, end - begin + 1);
+          _g_bytes_unref0 (bytes);
+        }
+
+      part = g_strdup_printf ("\r\n--%s--\r\n", boundary);
+      bytes = g_bytes_new_take (part, length = strlen (part));
+      total += length;
+
+      web_message_set_status (message, WEB_STATUS_CODE_PARTIAL_CONTENT);
+      web_message_body_add_bytes (body, bytes);
+      web_message_headers_set_content_length (response, total);
+      web_message_headers_replace_field_take (response, WEB_MESSAGE_FIELD_ID_CONTENT_TYPE, g_strdup_printf ("multipart/byteranges; boundary=%s", boundary));
+      _g_bytes_unref0 (bytes);
+      _g_free0 (boundary);
+    }
+return TRUE;
+}
+
 static void _root (AppServer* self, WebMessage* message, GFile* root, GError** error)
 {
   GError* tmperr = NULL;
-  GHashTable* params = NULL;
+  WebArena* arena = web_message_get_arena (message);
   GUri* uri = web_message_get_uri (message);
   const gchar* path = g_uri_get_path (uri);
   const gchar* query = g_uri_get_query (uri);
@@ -150,7 +396,7 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
   path = (path == NULL) ? "/" : path;
   query = (query == NULL) ? "" : query;
 
-  if ((params = g_uri_parse_params (query, -1, "&", G_URI_PARAMS_WWW_FORM, &tmperr)), G_UNLIKELY (tmperr != NULL))
+  if ((_query_check (query, &tmperr)), G_UNLIKELY (tmperr != NULL))
     g_propagate_error (error, tmperr);
   else
     {
@@ -164,6 +410,7 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
         {
           const gchar* type = NULL;
           const gchar* size = NULL;
+          const gchar* value = NULL;
           gboolean link = FALSE;
           guint64 size_ = 0;
           guint geometry = 0;
@@ -172,8 +419,8 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
             g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED, _("Permission denied"));
           else
             {
-              size = g_hash_table_contains (params, "size") == FALSE ? "16" : g_hash_table_lookup (params, "size");
-              link = g_hash_table_contains (params, "link") == FALSE ? link : g_str_equal (g_hash_table_lookup (params, "link"), "true");
+              size = (size = _param (arena, query, "size")) == NULL ? "16" : size;
+              link = (value = _param (arena, query, "link")) == NULL ? link : g_str_equal (value, "true");
 
               if ((g_ascii_string_to_unsigned (size, 10, 0, G_MAXINT, &size_, &tmperr)), G_UNLIKELY (tmperr != NULL))
                 {
@@ -239,7 +486,7 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
           const gchar* order = NULL;
 
           rpath = path + (sizeof ("/index/") - 1);
-          order = g_hash_table_contains (params, "order") == FALSE ? "n" : g_hash_table_lookup (params, "order");
+          order = (order = _param (arena, query, "order")) == NULL ? "n" : order;
           target = rpath [0] == 0 ? g_object_ref (root) : g_file_resolve_relative_path (root, rpath);
 
           if (_hierarchy (target, root) == FALSE)
@@ -278,35 +525,84 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
 
                       case G_FILE_TYPE_REGULAR:
                         {
+                          const gchar* content_type = g_file_info_get_content_type (info);
+                          const gchar* method = web_message_get_method (message);
+                          const goffset size = g_file_info_get_size (info);
                           gchar* filename = NULL;
                           GFileInputStream* stream = NULL;
                           GInputStream* stream2 = NULL;
                           WebMessageBody* body = NULL;
                           WebMessageHeaders* headers = NULL;
+                          WebMessageHeaders* request = NULL;
+                          gchar* etag = NULL;
+                          gchar* modified = NULL;
+                          gint64 mtime = -1;
+                          gint fd = -1;
+
+                          g_object_get (message, "request-headers", &request, NULL);
+                          g_object_get (message, "response-body", &body, NULL);
+                          g_object_get (message, "response-headers", &headers, NULL);
+
+                          _validators (info, &etag, &modified, &mtime);
+
+                          if (etag != NULL)
+                            web_message_headers_replace (headers, WEB_MESSAGE_FIELD_ETAG, etag);
+                          if (modified != NULL)
+                            web_message_headers_replace (headers, WEB_MESSAGE_FIELD_LAST_MODIFIED, modified);
+
+                          /* validators come from the metadata query alone, so
+                           * a revalidation never has to open the file */
+                          if (_not_modified (message, request, etag, mtime) == FALSE)
+                            {
+                              /* local files are handed to the connection as a descriptor,
+                               * so it can sendfile() them instead of streaming them through */
+                              if ((filename = g_file_get_path (target)) != NULL)
+                                {
+                                  fd = g_open (filename, O_RDONLY | O_CLOEXEC, 0);
+                                  _g_free0 (filename);
+                                }
 
-                          stream = g_file_read (target, NULL, &tmperr);
+                              if (fd >= 0)
+                                {
+                                  web_message_body_set_fd (body, fd);
+                                  web_message_headers_replace (headers, WEB_MESSAGE_FIELD_ACCEPT_RANGES, "bytes");
 
-                          if (G_UNLIKELY (tmperr != NULL))
-                            g_propagate_error (error, (_g_object_unref0 (stream), tmperr));
-                          else
-                            {
-                              stream2 = G_INPUT_STREAM (stream);
-                              stream2 = _app_stream_new (stream2);
-                              filename = g_file_get_basename (target);
-                              _g_object_unref0 (stream);
-
-                              g_object_get (message, "response-body", &body, NULL);
-                              g_object_get (message, "response-headers", &headers, NULL);
-
-                              web_message_set_status (message, WEB_STATUS_CODE_OK);
-                              web_message_body_set_stream (body, stream2);
-                              web_message_body_unref (body);
-                              web_message_headers_set_content_length (headers, g_file_info_get_size (info));
-                              web_message_headers_set_content_type (headers, g_file_info_get_content_type (info));
-                              web_message_headers_unref (headers);
-                              _g_object_unref0 (stream2);
-                              _g_free0 (filename);
+                                  if (g_str_equal (method, WEB_MESSAGE_METHOD_GET) == FALSE
+                                   || _if_range (request, etag, modified) == FALSE
+                                   || _ranges (message, request, headers, body, size, content_type) == FALSE)
+                                    {
+                                      web_message_set_status (message, WEB_STATUS_CODE_OK);
+                                      web_message_body_add_file (body, 0, size);
+                                      web_message_headers_set_content_length (headers, size);
+                                      web_message_headers_set_content_type (headers, content_type);
+                                    }
+                                }
+                              else
+                                {
+                                  stream = g_file_read (target, NULL, &tmperr);
+
+                                  if (G_UNLIKELY (tmperr != NULL))
+                                    g_propagate_error (error, (_g_object_unref0 (stream), tmperr));
+                                  else
+                                    {
+                                      stream2 = G_INPUT_STREAM (stream);
+                                      stream2 = _app_stream_new (stream2);
+                                      _g_object_unref0 (stream);
+
+                                      web_message_set_status (message, WEB_STATUS_CODE_OK);
+                                      web_message_body_set_stream (body, stream2);
+                                      web_message_headers_set_content_length (headers, size);
+                                      web_message_headers_set_content_type (headers, content_type);
+                                      _g_object_unref0 (stream2);
+                                    }
+                                }
                             }
+
+                          web_message_body_unref (body);
+                          web_message_headers_unref (headers);
+                          web_message_headers_unref (request);
+                          _g_free0 (etag);
+                          _g_free0 (modified);
                           break;
                         }
 
@@ -320,6 +616,7 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
                           else
                             {
                               GString* buffer = NULL;
+                              GChecksum* digest = NULL;
                               GEnumValue* enumv = NULL;
                               gsize filesize = 0;
                               GFileType filetype = 0;
@@ -336,6 +633,7 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
                               gchar* lastmodify_f = NULL;
                               gchar* rel = NULL;
                               gsize size = 0;
+                              gint64 stamp [4];
 
                               static const gchar blob1 [] =
                                 {
@@ -371,6 +669,7 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
                                 };
 
                               buffer = g_string_sized_new (1024);
+                              digest = g_checksum_new (G_CHECKSUM_MD5);
                               klass = g_type_class_ref (G_TYPE_FILE_TYPE);
                               rel = g_file_get_relative_path (root, target);
 
@@ -408,11 +707,32 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
 
                                   if (info2 == NULL)
                                     {
+                                      WebMessageHeaders* headers = NULL;
+                                      WebMessageHeaders* request = NULL;
+                                      gchar* etag = NULL;
+
                                       g_string_append_static (buffer, "</tbody> </table>");
                                       g_string_append_static (buffer, "</body> </html>");
                                       size = buffer->len;
-                                      web_message_set_status (message, WEB_STATUS_CODE_OK);
-                                      web_message_set_response_take (message, "text/html", g_string_free (g_steal_pointer (&buffer), FALSE), size);
+
+                                      /* a listing also changes when its children do, which the directory's
+                                       * own mtime does not track, so it is tagged by its entries; the access
+                                       * times it shows move on every read and are left out, hence weak */
+                                      etag = g_strdup_printf ("W/\"%s\"", g_checksum_get_string (digest));
+
+                                      g_object_get (message, "request-headers", &request, NULL);
+                                      g_object_get (message, "response-headers", &headers, NULL);
+                                      web_message_headers_replace (headers, WEB_MESSAGE_FIELD_ETAG, etag);
+
+                                      if (_not_modified (message, request, etag, -1) == FALSE)
+                                        {
+                                          web_message_set_status (message, WEB_STATUS_CODE_OK);
+                                          web_message_set_response_take (message, "text/html", g_string_free (g_steal_pointer (&buffer), FALSE), size);
+                                        }
+
+                                      web_message_headers_unref (headers);
+                                      web_message_headers_unref (request);
+                                      _g_free0 (etag);
                                       break;
                                     }
                                   else
@@ -427,6 +747,14 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
                                       lastaccess = g_file_info_get_access_date_time (info2);
                                       lastmodify = g_file_info_get_modification_date_time (info2);
 
+                                      stamp [0] = filesize;
+                                      stamp [1] = g_date_time_to_unix (lastmodify);
+                                      stamp [2] = filetype;
+                                      stamp [3] = (g_file_info_get_is_hidden (info2) ? 2 : 0) | (islink ? 1 : 0);
+
+                                      g_checksum_update (digest, (const guchar*) g_file_info_get_name (info2), strlen (g_file_info_get_name (info2)) + 1);
+                                      g_checksum_update (digest, (const guchar*) stamp, sizeof (stamp));
+
                                       _g_free0 (rel);
                                       g_string_append_printf (buffer, "<tr%s>\r\n", g_file_info_get_is_hidden (info2) == FALSE ? "" : " class=\"hidden-object\"");
                                       g_string_append_printf (buffer, "<td sortable-data=\"%s\">", g_file_info_get_display_name (info2));
@@ -449,6 +777,7 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
                                     }
                                 }
 
+                              g_checksum_free (digest);
                               g_type_class_unref (klass);
                               _g_string_unref0 (buffer);
                               _g_object_unref0 (enumerator);
@@ -488,29 +817,39 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
                 g_propagate_error (error, tmperr);
               else
                 {
-                  GInputStream* stream = NULL;
                   WebMessageBody* body = NULL;
                   WebMessageHeaders* headers = NULL;
+                  WebMessageHeaders* request = NULL;
+                  gchar* etag = NULL;
 
                   rdata = g_bytes_get_data (bytes, &length);
-                  name = g_path_get_basename (rpath);
-                  type = g_content_type_guess (name, rdata, length, NULL);
-                  stream = g_memory_input_stream_new_from_bytes (bytes);
 
+                  /* resources are compiled in and never change under a running server */
+                  etag = g_strdup_printf ("\"%08x-%" G_GSIZE_MODIFIER "x\"", g_bytes_hash (bytes), length);
+
+                  g_object_get (message, "request-headers", &request, NULL);
                   g_object_get (message, "response-body", &body, NULL);
                   g_object_get (message, "response-headers", &headers, NULL);
-                  g_bytes_unref (bytes);
-                  g_free (name);
+                  web_message_headers_replace (headers, WEB_MESSAGE_FIELD_ETAG, etag);
 
-                  web_message_set_status (message, WEB_STATUS_CODE_OK);
-                  web_message_body_set_stream (body, stream);
-                  web_message_body_unref (body);
-                  g_object_unref (stream);
+                  if (_not_modified (message, request, etag, -1) == FALSE)
+                    {
+                      name = g_path_get_basename (rpath);
+                      type = g_content_type_guess (name, rdata, length, NULL);
+
+                      web_message_set_status (message, WEB_STATUS_CODE_OK);
+                      web_message_body_add_bytes (body, bytes);
+                      web_message_headers_set_content_length (headers, length);
+                      web_message_headers_set_content_type (headers, type);
+                      g_free (name);
+                      g_free (type);
+                    }
 
-                  web_message_headers_set_content_length (headers, length);
-                  web_message_headers_set_content_type (headers, type);
+                  web_message_body_unref (body);
                   web_message_headers_unref (headers);
-                  g_free (type);
+                  web_message_headers_unref (request);
+                  g_bytes_unref (bytes);
+                  g_free (etag);
                 }
             }
         }
@@ -519,9 +858,6 @@ static void _root (AppServer* self, WebMessage* message, GFile* root, GError** e
           #undef prefixed
           g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED, _("Permission denied"));
         }
-
-      g_hash_table_remove_all (params);
-      g_hash_table_unref (params);
     }
 }
 
@@ -550,3 +886,42 @@ static void _status (WebMessage* message, WebStatusCode status_code, const gchar
   web_message_set_status (message, status_code);
   web_message_set_response_take (message, "text/html", response, strlen (response));
 }
+
+static gchar* _unescape (WebArena* arena, const gchar* value, gsize length)
+{
+  gchar* copy = web_arena_alloc (arena, length + 1);
+  gsize i, j;
+
+  for (i = 0, j = 0; i < length; ++i, ++j)
+    {
+      if (value [i] == '+')
+        copy [j] = ' ';
+      else if (value [i] != '%' || i + 2 >= length || !g_ascii_isxdigit (value [i + 1]) || !g_ascii_isxdigit (value [i + 2]))
+        copy [j] = value [i];
+      else
+        {
+          copy [j] = (g_ascii_xdigit_value (value [i + 1]) << 4) | g_ascii_xdigit_value (value [i + 2]);
+          i += 2;
+        }
+    }
+return (copy [j] = 0, copy);
+}
+
+static void _validators (GFileInfo* info, gchar** etag, gchar** modified, gint64* mtime)
+{
+  GDateTime* datetime = NULL;
+  GDateTime* utc = NULL;
+
+  if (g_file_info_get_etag (info) != NULL)
+    (*etag) = g_strdup_printf ("\"%s\"", g_file_info_get_etag (info));
+
+  if ((datetime = g_file_info_get_modification_date_time (info)) != NULL)
+    {
+      utc = g_date_time_to_utc (datetime);
+      (*modified) = g_date_time_format (utc, "%a, %d %b %Y %T GMT");
+      (*mtime) = g_date_time_to_unix (utc);
+      _g_date_time_unref0 (datetime);
+      _g_date_time_unref0 (utc);
+    }
+}
+
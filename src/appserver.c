@@ -16,21 +16,43 @@
  */
 #include <config.h>
 #include <appprivate.h>
+#include <webconnection.h>
 #include <webmessage.h>
 #include <webmessagemethods.h>
 #include <webserver.h>
 
 #define _g_object_unref0(var) ((var == NULL) ? NULL : (var = (g_object_unref (var), NULL)))
 
+struct _AppSite
+{
+  GFile* root;
+  AppServer* self;
+};
+
 struct _AppRequest
 {
+  gint64 enqueued;
   GFile* root;
   guint upload : 1;
   WebMessage* web_message;
 };
 
+enum
+{
+  prop_0,
+  prop_queue_delay_avg,
+  prop_queue_delay_max,
+  prop_queue_delay_min,
+  prop_queue_shed,
+  prop_number,
+};
+
 G_DECLARE_FINAL_TYPE (AppServer, app_server, APP, SERVER, GApplication);
 G_DEFINE_FINAL_TYPE (AppServer, app_server, G_TYPE_APPLICATION);
+static GParamSpec* properties [prop_number] = {0};
+static const guint retry_after_secs = 1;
+
+static gboolean queue_shed (AppServer* self, gint64 now);
 
 static void app_server_class_activate (GApplication* pself)
 {
@@ -60,9 +82,75 @@ static void app_server_class_finalize (GObject* pself)
   AppServer* self = (gpointer) pself;
   g_thread_pool_free (self->thread_pool, TRUE, TRUE);
   g_hash_table_unref (self->servers);
+  g_mutex_clear (& self->queue.lock);
 G_OBJECT_CLASS (app_server_parent_class)->finalize (pself);
 }
 
+static void app_server_class_get_property (GObject* pself, guint property_id, GValue* value, GParamSpec* pspec)
+{
+  AppServer* self = (gpointer) pself;
+
+  switch (property_id)
+    {
+      case prop_queue_delay_avg:
+        g_mutex_lock (& self->queue.lock);
+        g_value_set_int64 (value, self->queue.last_avg);
+        g_mutex_unlock (& self->queue.lock);
+        break;
+      case prop_queue_delay_max:
+        g_mutex_lock (& self->queue.lock);
+        g_value_set_int64 (value, self->queue.last_max);
+        g_mutex_unlock (& self->queue.lock);
+        break;
+      case prop_queue_delay_min:
+        g_mutex_lock (& self->queue.lock);
+        g_value_set_int64 (value, self->queue.last_min);
+        g_mutex_unlock (& self->queue.lock);
+        break;
+      case prop_queue_shed:
+        g_value_set_uint (value, g_atomic_int_get (& self->queue.n_shed));
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (pself, property_id, pspec);
+        break;
+    }
+}
+
+static gint app_server_class_handle_local_options (GApplication* pself, GVariantDict* options)
+{
+  AppServer* self = (gpointer) pself;
+  guint i;
+
+  const struct { const gchar* name; gint value; } limits [] =
+    {
+      { "keepalive-timeout", self->keepalive_timeout, },
+      { "max-connections", self->max_connections, },
+      { "max-header-bytes", self->max_header_bytes, },
+      { "max-header-count", self->max_header_count, },
+      { "max-header-length", self->max_header_length, },
+      { "max-pipelined", self->max_pipelined, },
+      { "max-queued-requests", self->max_queued_requests, },
+      { "max-request-line", self->max_request_line, },
+      { "max-requests", self->max_requests, },
+      { "queue-target", self->queue_target, },
+    };
+
+  /* zero stands for 'not given', anything below is a mistake */
+  for (i = 0; i < G_N_ELEMENTS (limits); ++i)
+  if (limits [i].value < 0)
+    {
+      g_printerr ("%s: --%s: value must not be negative\n", g_get_prgname (), limits [i].name);
+      return 1;
+    }
+
+  if (self->queue_interval <= 0)
+    {
+      g_printerr ("%s: --queue-interval: value must be positive\n", g_get_prgname ());
+      return 1;
+    }
+return -1;
+}
+
 static void on_got_failure (WebServer* web_server, GError* tmperr, AppServer* self)
 {
   const guint code = tmperr->code;
@@ -72,12 +160,14 @@ static void on_got_failure (WebServer* web_server, GError* tmperr, AppServer* se
   g_warning ("(" G_STRLOC "): %s: %d: %s", domain, code, message);
 }
 
-static gboolean on_got_request (WebServer* web_server, WebMessage* web_message, AppServer* self)
+static gboolean on_got_request (WebServer* web_server, WebMessage* web_message, struct _AppSite* site)
 {
+  AppServer* self = site->self;
   struct _AppRequest* request = NULL;
   const gchar* method = NULL;
   gboolean normal = TRUE;
   gboolean upload = TRUE;
+  gint queued;
 
   method = web_message_get_method (web_message);
 
@@ -85,22 +175,74 @@ static gboolean on_got_request (WebServer* web_server, WebMessage* web_message,
    || (normal = g_str_equal (method, WEB_MESSAGE_METHOD_POST))
    || (upload = g_str_equal (method, WEB_MESSAGE_METHOD_HEAD)))
     {
+      queued = g_atomic_int_add (& self->queued, 1);
+
+      /* past the queue limit, or while a standing queue delay persists
+       * (see queue_sample()), the request is answered right away from
+       * the parsing worker instead of waiting behind the others */
+      if ((self->max_queued_requests > 0 && queued >= self->max_queued_requests)
+       || (queued > 0 && queue_shed (self, g_get_monotonic_time ())))
+        {
+          g_atomic_int_add (& self->queued, -1);
+          g_atomic_int_inc (& self->queue.n_shed);
+          web_message_set_unavailable (web_message, retry_after_secs);
+          return TRUE;
+        }
+
       request = g_slice_new (struct _AppRequest);
-      request->root = g_hash_table_lookup (self->servers, web_server);
+      request->enqueued = g_get_monotonic_time ();
+      request->root = g_object_ref (site->root);
       request->upload = upload;
       request->web_message = g_object_ref (web_message);
 
-      g_assert (request->root != NULL);
-
       web_message_freeze (web_message);
       g_thread_pool_push (self->thread_pool, request, NULL);
     }
 return request != NULL;
 }
 
+static void set_limits (AppServer* self, WebServer* web_server)
+{
+  /* zero means the option was not given, the server default stays */
+  if (self->keepalive_timeout > 0)
+    web_server_set_keepalive_timeout (web_server, self->keepalive_timeout);
+  if (self->max_connections > 0)
+    web_server_set_max_connections (web_server, self->max_connections);
+  if (self->max_header_bytes > 0)
+    web_server_set_max_header_bytes (web_server, self->max_header_bytes);
+  if (self->max_header_count > 0)
+    web_server_set_max_header_count (web_server, self->max_header_count);
+  if (self->max_header_length > 0)
+    web_server_set_max_header_length (web_server, self->max_header_length);
+  if (self->max_request_line > 0)
+    web_server_set_max_request_line (web_server, self->max_request_line);
+  if (self->max_requests > 0)
+    web_server_set_max_requests (web_server, self->max_requests);
+  if (self->shed_connections)
+    web_server_set_shed_connections (web_server, TRUE);
+
+  if (self->max_pipelined > 0)
+    {
+      if (self->max_pipelined <= WEB_CONNECTION_MAX_PIPELINED)
+        web_server_set_max_pipelined (web_server, self->max_pipelined);
+      else
+        {
+          g_warning ("Pipelining depth %i too big, using %i", self->max_pipelined, WEB_CONNECTION_MAX_PIPELINED);
+          web_server_set_max_pipelined (web_server, WEB_CONNECTION_MAX_PIPELINED);
+        }
+    }
+}
+
+static void site_free (struct _AppSite* site)
+{
+  g_object_unref (site->root);
+  g_slice_free (struct _AppSite, site);
+}
+
 static void app_server_class_open (GApplication* pself, GFile** files, gint n_files, const gchar* hint)
 {
   AppServer* self = (gpointer) pself;
+  struct _AppSite* site = NULL;
   WebServer* web_server = NULL;
   GFile* current = g_file_new_for_path (".");
   GFile* subst = g_file_new_for_path ("/var/www");
@@ -116,6 +258,16 @@ static void app_server_class_open (GApplication* pself, GFile** files, gint n_fi
       guint64 port_number = 8080;
 
       web_server = web_server_new ();
+      set_limits (self, web_server);
+      site = g_slice_new (struct _AppSite);
+      site->root = g_object_ref (home);
+      site->self = self;
+
+      /* requests are handled straight from the worker that parsed
+       * them, without a round trip through the main context; both
+       * go in before listening so no request can miss them */
+      g_signal_connect (web_server, "got-failure", G_CALLBACK (on_got_failure), self);
+      web_server_add_handler (web_server, (WebServerHandler) on_got_request, site, (GDestroyNotify) site_free);
 
       if ((g_ascii_string_to_unsigned (port_name, 10, 0, G_MAXUINT16, &port_u64, &tmperr)), G_UNLIKELY (tmperr == NULL))
         port_number = (guint16) port_u64;
@@ -125,14 +277,21 @@ static void app_server_class_open (GApplication* pself, GFile** files, gint n_fi
           g_error_free (tmperr);
         }
 
-      if ((web_server_listen_any (web_server, port_number, 0, &tmperr)), G_UNLIKELY (tmperr != NULL))
+      if ((web_server_listen_any (web_server, port_number, WEB_LISTEN_OPTION_REUSE_PORT, &tmperr)), G_UNLIKELY (tmperr != NULL))
+        {
+          if (g_error_matches (tmperr, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+            {
+              g_clear_error (&tmperr);
+              web_server_listen_any (web_server, port_number, 0, &tmperr);
+            }
+        }
+
+      if (G_UNLIKELY (tmperr != NULL))
         {
           g_warning ("%s", tmperr->message);
           g_error_free (tmperr);
         }
 
-      g_signal_connect (web_server, "got-failure", G_CALLBACK (on_got_failure), self);
-      g_signal_connect (web_server, "got-request", G_CALLBACK (on_got_request), self);
       g_hash_table_insert (self->servers, web_server, g_object_ref (home));
     }
 
@@ -145,13 +304,115 @@ static void app_server_class_init (AppServerClass* klass)
   G_APPLICATION_CLASS (klass)->activate = app_server_class_activate;
   G_OBJECT_CLASS (klass)->dispose = app_server_class_dispose;
   G_OBJECT_CLASS (klass)->finalize = app_server_class_finalize;
+  G_OBJECT_CLASS (klass)->get_property = app_server_class_get_property;
+  G_APPLICATION_CLASS (klass)->handle_local_options = app_server_class_handle_local_options;
   G_APPLICATION_CLASS (klass)->open = app_server_class_open;
+
+  const GParamFlags flags1 = G_PARAM_READABLE | G_PARAM_STATIC_STRINGS;
+
+  /* delays are in microseconds, over the last whole --queue-interval;
+   * they are only measured while --queue-target is given */
+  properties [prop_queue_delay_avg] = g_param_spec_int64 ("queue-delay-avg", "queue-delay-avg", "queue-delay-avg", 0, G_MAXINT64, 0, flags1);
+  properties [prop_queue_delay_max] = g_param_spec_int64 ("queue-delay-max", "queue-delay-max", "queue-delay-max", 0, G_MAXINT64, 0, flags1);
+  properties [prop_queue_delay_min] = g_param_spec_int64 ("queue-delay-min", "queue-delay-min", "queue-delay-min", 0, G_MAXINT64, 0, flags1);
+  properties [prop_queue_shed] = g_param_spec_uint ("queue-shed", "queue-shed", "queue-shed", 0, G_MAXUINT, 0, flags1);
+  g_object_class_install_properties (G_OBJECT_CLASS (klass), prop_number, properties);
 }
 
-static void request_proc (struct _AppRequest* request, AppServer* self)
+static guint isqrt (guint n)
 {
-  _app_process (self, request->web_message, request->root);
-  web_message_thaw (request->web_message);
+  guint bit, root = 0;
+
+  for (bit = 1u << 30; bit > n; bit >>= 2);
+  for (; bit > 0; bit >>= 2)
+  if (n >= root + bit)
+    {
+      n -= root + bit;
+      root = (root >> 1) + bit;
+    }
+  else
+    root >>= 1;
+return root;
+}
+
+static void queue_sample (AppServer* self, gint64 now, gint64 delay)
+{
+  AppQueue* queue = & self->queue;
+  gboolean overloaded;
+
+  const gint64 interval = (gint64) self->queue_interval * G_TIME_SPAN_MILLISECOND;
+  const gint64 target = (gint64) self->queue_target * G_TIME_SPAN_MILLISECOND;
+
+  g_mutex_lock (& queue->lock);
+
+  if (queue->interval_end == 0)
+    queue->interval_end = now + interval;
+
+  queue->max_delay = MAX (queue->max_delay, delay);
+  queue->min_delay = MIN (queue->min_delay, delay);
+  queue->sum_delay += delay;
+  queue->n_samples += 1;
+
+  /* as in CoDel, only a delay which no request managed to get under
+   * during a whole interval counts as standing queue, short bursts
+   * drain by themselves and are never shed */
+  if (now >= queue->interval_end)
+    {
+      overloaded = queue->min_delay > target;
+
+      queue->last_avg = queue->sum_delay / queue->n_samples;
+      queue->last_max = queue->max_delay;
+      queue->last_min = queue->min_delay;
+
+      g_debug ("request queue: %u samples, delay min %" G_GINT64_FORMAT " avg %" G_GINT64_FORMAT " max %" G_GINT64_FORMAT " us, %u shed",
+               queue->n_samples, queue->last_min, queue->last_avg, queue->last_max, (guint) g_atomic_int_get (& queue->n_shed));
+
+      if (overloaded != (gboolean) g_atomic_int_get (& queue->overloaded))
+        {
+          if (overloaded)
+            g_message ("Request queue delay above %i ms, shedding new requests", self->queue_target);
+          else
+            g_message ("Request queue delay back under %i ms", self->queue_target);
+
+          queue->drop_count = 0;
+          queue->drop_next = now;
+          g_atomic_int_set (& queue->overloaded, overloaded);
+        }
+
+      queue->interval_end = now + interval;
+      queue->max_delay = 0;
+      queue->min_delay = G_MAXINT64;
+      queue->n_samples = 0;
+      queue->sum_delay = 0;
+    }
+
+  g_mutex_unlock (& queue->lock);
+}
+
+static gboolean queue_shed (AppServer* self, gint64 now)
+{
+  AppQueue* queue = & self->queue;
+  gboolean shed = FALSE;
+
+  const gint64 interval = (gint64) self->queue_interval * G_TIME_SPAN_MILLISECOND;
+
+  if (g_atomic_int_get (& queue->overloaded) == FALSE)
+    return FALSE;
+
+  g_mutex_lock (& queue->lock);
+
+  /* CoDel's control law: while the delay stands, the n-th request
+   * shed comes interval / sqrt (n) after the one before, so shedding
+   * steps up until the queue drains back under target */
+  if (queue->overloaded && now >= queue->drop_next)
+    {
+      shed = TRUE;
+      queue->drop_count += (queue->drop_count < G_MAXUINT) ? 1 : 0;
+      queue->drop_next = now + interval / isqrt (queue->drop_count);
+    }
+
+  g_mutex_unlock (& queue->lock);
+return shed;
 }
 
 static void request_free (struct _AppRequest* request)
@@ -161,6 +422,23 @@ static void request_free (struct _AppRequest* request)
   g_slice_free (struct _AppRequest, request);
 }
 
+static void request_proc (struct _AppRequest* request, AppServer* self)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  g_atomic_int_add (& self->queued, -1);
+
+  if (self->queue_target > 0)
+    queue_sample (self, now, now - request->enqueued);
+
+  _app_process (self, request->web_message, request->root);
+  web_message_thaw (request->web_message);
+
+  /* the pool only frees requests it never got to run, this one has to
+   * let go of the message here so the connection can recycle it */
+  request_free (request);
+}
+
 static void app_server_init (AppServer* self)
 {
   GHashFunc func1 = (GHashFunc) g_direct_hash;
@@ -170,6 +448,52 @@ static void app_server_init (AppServer* self)
   GDestroyNotify notify2 = (GDestroyNotify) request_free;
   guint max_threads = g_get_num_processors ();
 
+  const GOptionEntry entries [] =
+    {
+      { "keepalive-timeout", 0, 0, G_OPTION_ARG_INT, & self->keepalive_timeout, "Seconds an idle connection is kept open", "SECS", },
+      { "max-connections", 0, 0, G_OPTION_ARG_INT, & self->max_connections, "Maximum number of open connections", "N", },
+      { "max-header-bytes", 0, 0, G_OPTION_ARG_INT, & self->max_header_bytes, "Maximum size of a request header section", "BYTES", },
+      { "max-header-count", 0, 0, G_OPTION_ARG_INT, & self->max_header_count, "Maximum number of request header fields", "N", },
+      { "max-header-length", 0, 0, G_OPTION_ARG_INT, & self->max_header_length, "Maximum length of a single request header field", "BYTES", },
+      { "max-pipelined", 0, 0, G_OPTION_ARG_INT, & self->max_pipelined, "Maximum requests in flight per connection", "N", },
+      { "max-queued-requests", 0, 0, G_OPTION_ARG_INT, & self->max_queued_requests, "Maximum requests waiting for a worker thread", "N", },
+      { "max-request-line", 0, 0, G_OPTION_ARG_INT, & self->max_request_line, "Maximum length of a request line", "BYTES", },
+      { "max-requests", 0, 0, G_OPTION_ARG_INT, & self->max_requests, "Requests served before a connection is closed", "N", },
+      { "queue-interval", 0, 0, G_OPTION_ARG_INT, & self->queue_interval, "Window over which request queue delay is measured", "MSECS", },
+      { "queue-target", 0, 0, G_OPTION_ARG_INT, & self->queue_target, "Standing request queue delay past which new requests are shed", "MSECS", },
+      { "shed-connections", 0, 0, G_OPTION_ARG_NONE, & self->shed_connections, "Answer 503 past --max-connections instead of pausing accepts", NULL, },
+      { NULL, },
+    };
+
+  self->keepalive_timeout = 0;
+  self->max_connections = 0;
+  self->max_header_bytes = 0;
+  self->max_header_count = 0;
+  self->max_header_length = 0;
+  self->max_pipelined = 0;
+  self->max_queued_requests = 0;
+  self->max_request_line = 0;
+  self->max_requests = 0;
+  self->queue_interval = 100;
+  self->queue_target = 0;
+  self->queued = 0;
+  self->shed_connections = FALSE;
+
+  g_mutex_init (& self->queue.lock);
+  self->queue.drop_count = 0;
+  self->queue.drop_next = 0;
+  self->queue.interval_end = 0;
+  self->queue.last_avg = 0;
+  self->queue.last_max = 0;
+  self->queue.last_min = 0;
+  self->queue.max_delay = 0;
+  self->queue.min_delay = G_MAXINT64;
+  self->queue.n_samples = 0;
+  self->queue.n_shed = 0;
+  self->queue.overloaded = FALSE;
+  self->queue.sum_delay = 0;
+
+  g_application_add_main_option_entries (G_APPLICATION (self), entries);
   self->servers = g_hash_table_new_full (func1, func2, notify1, notify1);
   self->thread_pool = g_thread_pool_new_full (func3, self, notify2, max_threads, 0, NULL);
 }
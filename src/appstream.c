@@ -52,6 +52,12 @@ static void ready (GObject* pself, GAsyncResult* result, gpointer user_data)
     g_atomic_int_set (& self->fill_pending, FALSE);
 }
 
+static gboolean app_stream_g_pollable_input_stream_iface_is_readable (GPollableInputStream* pself)
+{
+  AppStream* self = (gpointer) pself;
+  return g_atomic_int_get (& self->fill_pending) == FALSE;
+}
+
 static gssize app_stream_g_pollable_input_stream_iface_read_nonblocking (GPollableInputStream* pself, void* buffer, gsize count, GError** error)
 {
   AppStream* self = (gpointer) pself;
@@ -82,6 +88,7 @@ return (read);
 
 static void app_stream_g_pollable_input_stream_iface (GPollableInputStreamInterface* iface)
 {
+  iface->is_readable = app_stream_g_pollable_input_stream_iface_is_readable;
   iface->read_nonblocking = app_stream_g_pollable_input_stream_iface_read_nonblocking;
 }
 
@@ -0,0 +1,161 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <webmessage.h>
+
+#define ROUNDS (200000)
+#define RUNS (5)
+
+typedef struct _Headers Headers;
+
+struct _Headers
+{
+  GHashTable* fields;
+  GQueue taken;
+};
+
+static const gchar* fields [][2] =
+{
+  { "host", "localhost:8080", },
+  { "user-agent", "Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0", },
+  { "accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8", },
+  { "accept-language", "en-US,en;q=0.5", },
+  { "accept-encoding", "gzip, deflate, br", },
+  { "connection", "keep-alive", },
+  { "upgrade-insecure-requests", "1", },
+  { "sec-fetch-dest", "document", },
+  { "sec-fetch-mode", "navigate", },
+  { "sec-fetch-site", "none", },
+};
+
+static guint n_allocs = 0;
+
+#if defined (__GLIBC__)
+
+/* every g_malloc () and g_slice_alloc () ends up here */
+extern void* __libc_calloc (size_t n, size_t size);
+extern void* __libc_malloc (size_t size);
+extern void* __libc_realloc (void* mem, size_t size);
+
+void* calloc (size_t n, size_t size) { return (++n_allocs, __libc_calloc (n, size)); }
+void* malloc (size_t size) { return (++n_allocs, __libc_malloc (size)); }
+void* realloc (void* mem, size_t size) { return (++n_allocs, __libc_realloc (mem, size)); }
+
+#endif // __GLIBC__
+
+static void headers_append (Headers* self, const gchar* key, const gchar* value)
+{
+  GQueue* list;
+  gchar* name = g_strdup (key);
+  gchar* values = g_strdup (value);
+  gsize i, l, length = strlen (values);
+
+  /* the GHashTable of GQueues WebMessageHeaders was before
+   * it became a flat vector, one GList link per element */
+  if ((list = g_hash_table_lookup (self->fields, name)) != NULL)
+    g_free (name);
+  else
+    g_hash_table_insert (self->fields, name, list = g_queue_new ());
+
+  for (i = 0, l = 0; i <= length; ++i)
+  if (values [i] == ',' || values [i] == 0)
+    {
+      values [i] = 0;
+
+      if (i > l)
+        g_queue_push_tail (list, g_strstrip (& values [l]));
+      l = i + 1;
+    }
+
+  g_queue_push_tail (& self->taken, values);
+}
+
+static gdouble run_flat (guint* allocs)
+{
+  WebMessageHeaders* headers;
+  gint64 start;
+  guint i, j;
+
+  start = (*allocs = n_allocs, g_get_monotonic_time ());
+
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      headers = web_message_headers_new ();
+
+      for (j = 0; j < G_N_ELEMENTS (fields); ++j)
+        web_message_headers_append (headers, fields [j][0], fields [j][1]);
+
+      g_assert (web_message_headers_get_keep_alive (headers) == TRUE);
+      g_assert (web_message_headers_get_one (headers, "sec-fetch-mode") != NULL);
+      web_message_headers_unref (headers);
+    }
+
+  *allocs = (n_allocs - *allocs) / ROUNDS;
+return (g_get_monotonic_time () - start) * 1000.0 / ROUNDS;
+}
+
+static gdouble run_table (guint* allocs)
+{
+  Headers headers;
+  gint64 start;
+  guint i, j;
+
+  const GHashFunc func1 = (GHashFunc) g_str_hash;
+  const GEqualFunc func2 = (GEqualFunc) g_str_equal;
+  const GDestroyNotify func3 = (GDestroyNotify) g_queue_free;
+
+  start = (*allocs = n_allocs, g_get_monotonic_time ());
+
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      headers.fields = g_hash_table_new_full (func1, func2, g_free, func3);
+      g_queue_init (& headers.taken);
+
+      for (j = 0; j < G_N_ELEMENTS (fields); ++j)
+        headers_append (&headers, fields [j][0], fields [j][1]);
+
+      g_assert (g_hash_table_lookup (headers.fields, "connection") != NULL);
+      g_assert (g_hash_table_lookup (headers.fields, "sec-fetch-mode") != NULL);
+
+      g_hash_table_unref (headers.fields);
+      g_queue_clear_full (& headers.taken, g_free);
+    }
+
+  *allocs = (n_allocs - *allocs) / ROUNDS;
+return (g_get_monotonic_time () - start) * 1000.0 / ROUNDS;
+}
+
+int main (int argc, gchar* argv [])
+{
+  gdouble after = G_MAXDOUBLE, before = G_MAXDOUBLE;
+  guint after_allocs, before_allocs;
+  guint i;
+
+  /* best of a few runs, a single one is easily off
+   * by a third on a machine doing anything else */
+  for (i = 0; i < RUNS; ++i)
+    {
+      before = MIN (before, run_table (&before_allocs));
+      after = MIN (after, run_flat (&after_allocs));
+    }
+
+  g_print ("GHashTable of GQueues: %4u allocations, %8.1f ns per header set\n", before_allocs, before);
+  g_print ("flat entry vector:     %4u allocations, %8.1f ns per header set\n", after_allocs, after);
+return 0;
+}
@@ -0,0 +1,114 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <gio/gio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <webconnection.h>
+#include <webmessage.h>
+
+#define ROUNDS (200000)
+
+G_GNUC_INTERNAL void _web_message_cache_drain (void);
+
+static const gchar request [] = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+
+static WebMessage* step (WebConnection* web_connection)
+{
+  GError* tmperr = NULL;
+  WebMessage* web_message = NULL;
+
+  if ((web_message = web_connection_step (web_connection, &tmperr)), G_UNLIKELY (tmperr != NULL))
+    g_error ("%s: %u: %s", g_quark_to_string (tmperr->domain), tmperr->code, tmperr->message);
+return web_message;
+}
+
+static gdouble run (gboolean hold, guint* created)
+{
+  WebConnection* web_connection;
+  WebMessage* web_message;
+  GSocket* socket;
+  GQuark seen;
+  gchar buffer [4096];
+  gint64 start;
+  gint fds [2];
+  guint i;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    g_error ("socketpair (): %s", g_strerror (errno));
+  if ((socket = g_socket_new_from_fd (fds [0], NULL)) == NULL)
+    g_error ("g_socket_new_from_fd () failed");
+
+  g_socket_set_blocking (socket, FALSE);
+
+  web_connection = web_connection_new (socket, FALSE);
+  seen = g_quark_from_static_string ("benchmessage-seen");
+  start = g_get_monotonic_time ();
+  *created = 0;
+
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      if (write (fds [1], request, sizeof (request) - 1) != sizeof (request) - 1)
+        g_error ("write (): %s", g_strerror (errno));
+      if ((web_message = step (web_connection)) == NULL)
+        g_error ("request was not parsed in one step");
+
+      /* messages keep their qdata while they sit in the cache,
+       * so an untagged one has just been constructed */
+      if (g_object_get_qdata (G_OBJECT (web_message), seen) == NULL)
+        {
+          g_object_set_qdata (G_OBJECT (web_message), seen, GUINT_TO_POINTER (TRUE));
+          *created += 1;
+        }
+
+      web_message_set_response (web_message, "text/plain", "OK", 2);
+      web_message_set_status (web_message, WEB_STATUS_CODE_OK);
+      web_connection_send (web_connection, web_message);
+
+      /* a handler holding on to its request past the write (as
+       * AppRequest did) keeps the connection from recycling it */
+      if (hold == FALSE)
+        g_object_unref (web_message);
+      if (step (web_connection) != NULL)
+        g_error ("no request was written");
+      if (hold == TRUE)
+        g_object_unref (web_message);
+
+      if (read (fds [1], buffer, sizeof (buffer)) <= 0)
+        g_error ("no response was written");
+    }
+
+  start = g_get_monotonic_time () - start;
+
+  g_object_unref (web_connection);
+  g_object_unref (socket);
+  close (fds [1]);
+return start * 1000.0 / ROUNDS;
+}
+
+int main (int argc, gchar* argv [])
+{
+  guint created_after, created_before;
+  gdouble after, before;
+
+  before = run (TRUE, &created_before);
+  after = run (FALSE, &created_after);
+
+  g_print ("held past the write:     %8.1f ns/request, %6u messages constructed\n", before, created_before);
+  g_print ("released after send ():  %8.1f ns/request, %6u messages constructed\n", after, created_after);
+return (_web_message_cache_drain (), 0);
+}
@@ -0,0 +1,167 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <string.h>
+#include <webhttpversion.h>
+#include <webparser.h>
+
+#define ROUNDS (200000)
+#define RUNS (5)
+
+typedef struct _Field Field;
+
+/* components */
+#define CTL "\\x{0}-\\x{1f}"
+#define SP "\\x{20}"
+#define HT "\\x{09}"
+#define SPECIALS "\\(\\)<>@,;:\\\\\"/\\[\\]\\?={}\\x{0a}\\x{0d}"
+
+/* entities */
+#define TOKEN "[^" CTL SPECIALS "]"
+
+struct _Field
+{
+  gchar* name;
+  gchar* value;
+};
+
+static const gchar* request [] =
+{
+  "GET /static/index.css?v=3 HTTP/1.1",
+  "Host: localhost:8080",
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0",
+  "Accept: text/css,*/*;q=0.1",
+  "Accept-Language: en-US,en;q=0.5",
+  "Accept-Encoding: gzip, deflate, br",
+  "Connection: keep-alive",
+  "Referer: http://localhost:8080/",
+  "Sec-Fetch-Dest: style",
+  "Sec-Fetch-Mode: no-cors",
+  "Sec-Fetch-Site: same-origin",
+  "",
+};
+
+static void field_free (Field* field)
+{
+  g_free (field->name);
+  g_free (field->value);
+  g_slice_free (Field, field);
+}
+
+static gdouble run_parser (void)
+{
+  GError* tmperr = NULL;
+  WebParser parser;
+  gint64 start;
+  guint i, j;
+
+  web_parser_init (&parser);
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      for (j = 0; j < G_N_ELEMENTS (request); ++j)
+        if ((web_parser_feed (&parser, request [j], strlen (request [j]), &tmperr)), G_UNLIKELY (tmperr != NULL))
+          g_error ("%s: %u: %s", g_quark_to_string (tmperr->domain), tmperr->code, tmperr->message);
+
+      g_assert (parser.complete == TRUE);
+      web_parser_reset (&parser);
+    }
+return (web_parser_clear (&parser), ROUNDS * 1000000.0 / (g_get_monotonic_time () - start));
+}
+
+static gdouble run_regex (void)
+{
+  GRegex* full_request_line;
+  GRegex* simple_field;
+  GUri* base_uri;
+  GQueue fields = G_QUEUE_INIT;
+  GMatchInfo* info = NULL;
+  gint64 start;
+  guint i, j;
+
+  gint begin, end;
+  gint value_begin, value_end;
+
+  /* the matching WebParser did per line before it was hand written */
+  base_uri = g_uri_parse ("http://localhost/", G_URI_FLAGS_NON_DNS, NULL);
+  full_request_line = g_regex_new ("^(" TOKEN "+)\\s(.+?)\\sHTTP/([0-9]+)\\.([0-9]+)$", G_REGEX_OPTIMIZE | G_REGEX_RAW, 0, NULL);
+  simple_field = g_regex_new ("^(" TOKEN "+):\\s(.+)$", G_REGEX_OPTIMIZE | G_REGEX_RAW, 0, NULL);
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < ROUNDS; ++i)
+    {
+      gchar* path;
+      GUri* uri;
+
+      if (g_regex_match_full (full_request_line, request [0], strlen (request [0]), 0, 0, &info, NULL) == FALSE)
+        g_error ("request line did not match");
+
+      g_match_info_fetch_pos (info, 2, &begin, &end);
+      g_match_info_free (info);
+
+      path = g_utf8_make_valid (request [0] + begin, end - begin);
+      uri = g_uri_parse_relative (base_uri, path, G_URI_FLAGS_NON_DNS, NULL);
+
+      g_free (path);
+      g_uri_unref (uri);
+
+      for (j = 1; j < G_N_ELEMENTS (request) - 1; ++j)
+        {
+          Field* field;
+
+          if (g_regex_match_full (simple_field, request [j], strlen (request [j]), 0, 0, &info, NULL) == FALSE)
+            g_error ("field '%s' did not match", request [j]);
+
+          g_match_info_fetch_pos (info, 1, &begin, &end);
+          g_match_info_fetch_pos (info, 2, &value_begin, &value_end);
+          g_match_info_free (info);
+
+          field = g_slice_new (Field);
+          field->name = g_ascii_strdown (request [j] + begin, end - begin);
+          field->value = g_strndup (request [j] + value_begin, value_end - value_begin);
+          g_queue_push_tail (&fields, field);
+        }
+
+      g_queue_clear_full (&fields, (GDestroyNotify) field_free);
+    }
+
+  start = g_get_monotonic_time () - start;
+
+  g_regex_unref (full_request_line);
+  g_regex_unref (simple_field);
+  g_uri_unref (base_uri);
+return ROUNDS * 1000000.0 / start;
+}
+
+int main (int argc, gchar* argv [])
+{
+  gdouble after = 0, before = 0;
+  guint i;
+
+  /* best of a few runs, a single one is easily off
+   * by a third on a machine doing anything else */
+  for (i = 0; i < RUNS; ++i)
+    {
+      before = MAX (before, run_regex ());
+      after = MAX (after, run_parser ());
+    }
+
+  g_print ("GRegex matching:    %10.0f requests/s\n", before);
+  g_print ("web_parser_feed (): %10.0f requests/s\n", after);
+return 0;
+}
@@ -0,0 +1,102 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <string.h>
+#include <webarena.h>
+
+#define ARENA_ALIGN (2 * GLIB_SIZEOF_VOID_P)
+#define ARENA_BLOCK_MIN (1024)
+#define align(size) (((size) + (ARENA_ALIGN - 1)) & ~((gsize) ARENA_ALIGN - 1))
+
+struct _WebArenaBlock
+{
+  WebArenaBlock* next;
+  gsize size;
+};
+
+G_STATIC_ASSERT (sizeof (WebArenaBlock) % ARENA_ALIGN == 0);
+
+gpointer web_arena_alloc (WebArena* arena, gsize size)
+{
+  WebArenaBlock* block = NULL;
+  gsize blocksz;
+
+  /* a bump allocator over a chain of blocks: nothing is freed on its
+   * own, so pointers stay valid until the arena is reset or cleared */
+  if ((size = align (size)) == 0)
+    size = ARENA_ALIGN;
+
+  if (arena->blocks == NULL || arena->offset + size > arena->blocks->size)
+    {
+      blocksz = (arena->blocks == NULL) ? ARENA_BLOCK_MIN : (arena->blocks->size << 1);
+      blocksz = MAX (blocksz, size);
+
+      block = g_malloc (sizeof (WebArenaBlock) + blocksz);
+      block->next = arena->blocks;
+      block->size = blocksz;
+
+      arena->blocks = block;
+      arena->offset = 0;
+    }
+
+  block = arena->blocks;
+  arena->offset += size;
+return G_STRUCT_MEMBER_P (block + 1, arena->offset - size);
+}
+
+void web_arena_clear (WebArena* arena)
+{
+  WebArenaBlock* block = NULL;
+
+  while ((block = arena->blocks) != NULL)
+    {
+      arena->blocks = block->next;
+      g_free (block);
+    }
+
+  arena->offset = 0;
+}
+
+void web_arena_init (WebArena* arena)
+{
+  arena->blocks = NULL;
+  arena->offset = 0;
+}
+
+void web_arena_reset (WebArena* arena)
+{
+  WebArenaBlock* block = NULL;
+
+  /* the newest block is also the biggest one, keep it around */
+  if ((block = arena->blocks) != NULL)
+    {
+      arena->blocks = block->next;
+      web_arena_clear (arena);
+      arena->blocks = (block->next = NULL, block);
+    }
+
+  arena->offset = 0;
+}
+
+gchar* web_arena_strndup (WebArena* arena, const gchar* str, gsize length)
+{
+  gchar* copy = web_arena_alloc (arena, length + 1);
+
+  memcpy (copy, str, length);
+  copy [length] = 0;
+return copy;
+}
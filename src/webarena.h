@@ -0,0 +1,44 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __WEB_ARENA__
+#define __WEB_ARENA__ 1
+#include <glib.h>
+
+typedef struct _WebArena WebArena;
+typedef struct _WebArenaBlock WebArenaBlock;
+
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  struct _WebArena
+  {
+    WebArenaBlock* blocks;
+    gsize offset;
+  };
+
+  G_GNUC_INTERNAL gpointer web_arena_alloc (WebArena* arena, gsize size) G_GNUC_MALLOC;
+  G_GNUC_INTERNAL void web_arena_clear (WebArena* arena);
+  G_GNUC_INTERNAL void web_arena_init (WebArena* arena);
+  G_GNUC_INTERNAL void web_arena_reset (WebArena* arena);
+  G_GNUC_INTERNAL gchar* web_arena_strndup (WebArena* arena, const gchar* str, gsize length) G_GNUC_MALLOC;
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
+#endif // __WEB_ARENA__
@@ -15,26 +15,50 @@
  * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <config.h>
+#include <errno.h>
 #include <marshals.h>
 #include <gio/gnetworking.h>
 #include <glib/gi18n.h>
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+# include <sys/sendfile.h>
+#endif // HAVE_SENDFILE
+#include <time.h>
+#include <unistd.h>
 #include <webconnection.h>
 #include <webmessage.h>
 #include <webmessagefields.h>
 #include <webmessagemethods.h>
 #include <webparser.h>
+#include <webtimerwheel.h>
+#ifdef HAVE_IO_URING
+# include <sys/uio.h>
+# include <webring.h>
+#endif // HAVE_IO_URING
 
 #define WEB_CONNECTION_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), WEB_TYPE_CONNECTION, WebConnectionClass))
 #define WEB_IS_CONNECTION_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), WEB_TYPE_CONNECTION))
 #define WEB_CONNECTION_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), WEB_TYPE_CONNECTION, WebConnectionClass))
 typedef struct _WebConnectionClass WebConnectionClass;
+G_GNUC_INTERNAL WebMessage* _web_message_acquire (void);
 G_GNUC_INTERNAL guint _web_message_get_freeze_count (WebMessage* web_message);
+G_GNUC_INTERNAL guint _web_message_get_seqid (WebMessage* web_message);
+G_GNUC_INTERNAL void _web_message_release (WebMessage* web_message);
+G_GNUC_INTERNAL void _web_message_set_seqid (WebMessage* web_message, guint seqid);
 #define _g_error_free0(var) ((var == NULL) ? NULL : (var = (g_error_free (var), NULL)))
 #define _g_free0(var) ((var == NULL) ? NULL : (var = (g_free (var), NULL)))
 #define _g_object_unref0(var) ((var == NULL) ? NULL : (var = (g_object_unref (var), NULL)))
-const guint keepalive_timeout_secs = 6;
-typedef struct _Frame Frame;
+#define _web_message_body_unref0(var) ((var == NULL) ? NULL : (var = (web_message_body_unref (var), NULL)))
+const guint header_timeout_secs = 15;
+const guint write_timeout_secs = 30;
+#define INPUT_BLOCK_MIN (4096)
+#define INPUT_BLOCK_LIMIT (1048576)
+#define INPUT_BLOCK_MAX (65536)
+#define INPUT_CACHE_MAX (32)
+#define DATE_LENGTH (sizeof ("Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n") - 1)
+#define DATE_WORDS (DATE_LENGTH / sizeof (gsize) + 1)
+#define OUTPUT_RING_SIZE (WEB_CONNECTION_MAX_PIPELINED)
 typedef struct _Range Range;
+typedef struct _WebConnectionSource WebConnectionSource;
 
 struct _WebConnection
 {
@@ -45,17 +69,34 @@ struct _WebConnection
   guint is_https : 1;
   GInputStream* input_stream;
   GIOStream* iostream;
+  WebConnectionLimits limits;
   GOutputStream* output_stream;
   GSocket* socket;
   GSocketConnection* socket_connection;
+  GSource* source;
+  guint expired : 1;
+  WebTimer timer;
+  WebTimerWheel* wheel;
+#ifdef HAVE_IO_URING
+  WebRing* ring;
+#endif // HAVE_IO_URING
 
   struct _InputIO
   {
     gsize allocated;
     gpointer buffer;
     guint closed : 1;
+    guint failed : 1;
     gsize length;
+    gsize offset;
     WebParser parser;
+#ifdef HAVE_IO_URING
+    guint ring_done : 1;
+    WebRingOp* ring_op;
+    guint ring_poll : 1;
+    gint ring_result;
+#endif // HAVE_IO_URING
+    gint64 started;
     gsize unscanned;
     gint64 uptime;
   } in;
@@ -63,16 +104,33 @@ struct _WebConnection
   struct _OutputIO
   {
     gsize allocated;
+    WebMessageBody* body;
     gpointer buffer;
     guint closed : 1;
+    gint fd;
     guint is_closure : 1;
+    gchar keepalive [sizeof ("Keep-Alive: timeout=4294967295\r\n")];
+    gsize keepalive_length;
     gsize length;
     GMutex lock;
-    GQueue queue;
+    guint n_oob;
+    GQueue oob;
     GQueue ranges;
+    WebMessage* ring [OUTPUT_RING_SIZE];
     guint seqidn;
     guint seqidp;
+#ifdef HAVE_IO_URING
+    guint ring_done : 1;
+    struct iovec ring_iov [16];
+    struct msghdr ring_msg;
+    WebRingOp* ring_op;
+    guint ring_poll : 1;
+    gint ring_result;
+#endif // HAVE_IO_URING
+    gsize chunk_offset;
+    GQueue chunks;
     GPollableInputStream* splice;
+    gint64 uptime;
     gsize wrote;
   } out;
 };
@@ -82,23 +140,20 @@ struct _WebConnectionClass
   GObjectClass parent;
 };
 
-struct _Frame
-{
-  union
-  {
-    guint seqid;
-    gpointer seqid_ptr;
-  };
-
-  WebMessage* web_message;
-};
-
 struct _Range
 {
   goffset offset;
   goffset length;
 };
 
+struct _WebConnectionSource
+{
+  GSource parent;
+  GIOCondition events;
+  gpointer tag;
+  WebConnection* web_connection;
+};
+
 enum
 {
   prop_0,
@@ -109,7 +164,6 @@ enum
 
 G_DEFINE_FINAL_TYPE (WebConnection, web_connection, G_TYPE_OBJECT);
 G_DEFINE_QUARK (web-connection-error-quark, web_connection_error);
-G_DEFINE_QUARK (web-connection-sequence-id-quark, seqid);
 static GParamSpec* properties [prop_number] = {0};
 
 static void web_connection_class_constructed (GObject* pself)
@@ -126,21 +180,6 @@ G_OBJECT_CLASS (web_connection_parent_class)->constructed (pself);
   else g_assert_not_reached ();
 }
 
-static int frame_cmp (gconstpointer a_, gconstpointer b_, gpointer u)
-{
-  guint a = G_STRUCT_MEMBER (guint, a_, G_STRUCT_OFFSET (struct _Frame, seqid));
-  guint b = G_STRUCT_MEMBER (guint, b_, G_STRUCT_OFFSET (struct _Frame, seqid));
-return (a < b) ? -1 : ((a == b) ? 0 : 1);
-}
-
-static void frame_free (gpointer ptr)
-{
-  struct _Frame* frame = ptr;
-
-  _g_object_unref0 (frame->web_message);
-  g_slice_free (struct _Frame, frame);
-}
-
 static int range_cmp (gconstpointer a_, gconstpointer b_, gpointer u)
 {
   gsize a = G_STRUCT_MEMBER (gsize, a_, G_STRUCT_OFFSET (Range, offset));
@@ -163,15 +202,84 @@ static void range_free (gpointer ptr)
   g_slice_free (Range, ptr);
 }
 
+static void in_cache_free (GQueue* cache)
+{
+  g_queue_free_full (cache, g_free);
+}
+
+static GPrivate in_cache = G_PRIVATE_INIT ((GDestroyNotify) in_cache_free);
+
+static gpointer in_buffer_acquire (void)
+{
+  GQueue* cache = NULL;
+
+  if ((cache = g_private_get (&in_cache)) == NULL || cache->length == 0)
+    return g_malloc (INPUT_BLOCK_MIN);
+return g_queue_pop_head (cache);
+}
+
+static void in_buffer_release (gpointer buffer, gsize allocated)
+{
+  GQueue* cache = NULL;
+
+  /* only minimum-sized buffers are kept, larger ones
+   * were grown for one unusual request */
+  if (buffer == NULL)
+    return;
+  else if (allocated != INPUT_BLOCK_MIN)
+    g_free (buffer);
+  else
+    {
+      if ((cache = g_private_get (&in_cache)) == NULL)
+        g_private_set (&in_cache, cache = g_queue_new ());
+
+      if (cache->length >= INPUT_CACHE_MAX)
+        g_free (buffer);
+      else
+        g_queue_push_head (cache, buffer);
+    }
+}
+
+static WebMessageChunk* chunk_new (GBytes* bytes, goffset offset, goffset length)
+{
+  WebMessageChunk* chunk = g_slice_new (WebMessageChunk);
+
+  chunk->bytes = bytes;
+  chunk->offset = offset;
+  chunk->length = length;
+return chunk;
+}
+
+static void chunk_free (WebMessageChunk* chunk)
+{
+  if (chunk->bytes != NULL)
+    g_bytes_unref (chunk->bytes);
+  g_slice_free (WebMessageChunk, chunk);
+}
+
 static void web_connection_class_dispose (GObject* pself)
 {
   WebConnection* self = (gpointer) pself;
+  guint i;
+
+  web_timer_cancel (& self->timer);
   _g_object_unref0 (self->input_stream);
   _g_object_unref0 (self->iostream);
   g_mutex_clear (& self->out.lock);
   _g_object_unref0 (self->out.splice);
-  g_queue_clear_full (& self->out.queue, frame_free);
+  _web_message_body_unref0 (self->out.body);
+  g_queue_clear_full (& self->out.chunks, (GDestroyNotify) chunk_free);
+  g_queue_clear_full (& self->out.oob, g_object_unref);
   g_queue_clear_full (& self->out.ranges, range_free);
+
+  /* disposal may run on any thread (the worker's context going
+   * away), so unsent responses are not recycled into its cache */
+  for (i = 0; i < OUTPUT_RING_SIZE; ++i)
+    {
+      if (self->out.ring [i] != NULL)
+        g_object_unref (g_steal_pointer (& self->out.ring [i]));
+    }
+
   _g_object_unref0 (self->output_stream);
   _g_object_unref0 (self->socket);
   _g_object_unref0 (self->socket_connection);
@@ -182,7 +290,7 @@ static void web_connection_class_finalize (GObject* pself)
 {
   WebConnection* self = (gpointer) pself;
 
-  _g_free0 (self->in.buffer);
+  in_buffer_release (self->in.buffer, self->in.allocated);
   web_parser_clear (& self->in.parser);
   _g_free0 (self->out.buffer);
 G_OBJECT_CLASS (web_connection_parent_class)->finalize (pself);
@@ -224,26 +332,68 @@ static void web_connection_class_init (WebConnectionClass* klass)
   g_object_class_install_properties (G_OBJECT_CLASS (klass), prop_number, properties);
 }
 
+static void on_timeout (WebConnection* self)
+{
+  GSource* source = NULL;
+
+  /* runs on the worker owning both the wheel and the source */
+  self->expired = TRUE;
+
+  if ((source = self->source) != NULL)
+    g_source_set_ready_time (source, 0);
+}
+
 static void web_connection_init (WebConnection* self)
 {
+  self->expired = FALSE;
   self->http_version = WEB_HTTP_VERSION_NONE;
 
   self->in.allocated = 0;
   self->in.buffer = NULL;
+  self->in.failed = FALSE;
   self->in.length = 0;
+  self->in.offset = 0;
+  self->in.started = 0;
   self->in.unscanned = 0;
   self->in.uptime = g_get_monotonic_time ();
+  self->limits.keepalive_timeout = 6;
+  self->limits.max_header_bytes = G_MAXUINT;
+  self->limits.max_header_count = G_MAXUINT;
+  self->limits.max_header_length = G_MAXUINT;
+  self->limits.max_pipelined = WEB_CONNECTION_MAX_PIPELINED;
+  self->limits.max_request_line = G_MAXUINT;
+  self->limits.max_requests = G_MAXUINT;
+  self->source = NULL;
+  self->wheel = NULL;
+#ifdef HAVE_IO_URING
+  self->ring = NULL;
+  self->in.ring_done = FALSE;
+  self->in.ring_op = NULL;
+  self->in.ring_poll = FALSE;
+  self->out.ring_done = FALSE;
+  self->out.ring_op = NULL;
+  self->out.ring_poll = FALSE;
+#endif // HAVE_IO_URING
   self->out.allocated = 0;
+  self->out.body = NULL;
   self->out.buffer = NULL;
+  self->out.chunk_offset = 0;
+  self->out.fd = -1;
   self->out.is_closure = 0;
+  self->out.keepalive_length = g_snprintf (self->out.keepalive, sizeof (self->out.keepalive), "Keep-Alive: timeout=%u\r\n", self->limits.keepalive_timeout);
   self->out.length = 0;
+  self->out.n_oob = 0;
   self->out.seqidn = 0;
   self->out.seqidp = 0;
+  self->out.uptime = 0;
   self->out.wrote = 0;
 
   web_parser_init (& self->in.parser);
+  web_timer_init (& self->timer, (WebTimerCallback) on_timeout, self);
   g_mutex_init (& self->out.lock);
-  g_queue_init (& self->out.queue);
+  g_queue_init (& self->out.chunks);
+  g_queue_init (& self->out.oob);
+  memset (self->out.ring, 0, sizeof (self->out.ring));
 }
 
 WebConnection* web_connection_new (GSocket* socket, gboolean is_https)
@@ -251,24 +401,249 @@ WebConnection* web_connection_new (GSocket* socket, gboolean is_https)
   return g_object_new (WEB_TYPE_CONNECTION, "socket", socket, "is-https", is_https, NULL);
 }
 
-static GIOStatus process_in (struct _InputIO* io, GPollableInputStream* stream, GError** error)
+static void wakeup (WebConnection* self)
 {
-  GError* tmperr = NULL;
-  gpointer block;
-  gssize read;
+  GSource* source = NULL;
 
-  const goffset blocksz = 256;
+  g_mutex_lock (& self->out.lock);
+  source = (self->source == NULL) ? NULL : g_source_ref (self->source);
+  g_mutex_unlock (& self->out.lock);
 
-  while (TRUE)
+  if (source != NULL)
+    {
+      g_source_set_ready_time (source, 0);
+      g_source_unref (source);
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+static void on_recv_done (gint result, WebConnection* self)
+{
+  self->in.ring_done = TRUE;
+  self->in.ring_op = NULL;
+  self->in.ring_result = result;
+  wakeup (self);
+  g_object_unref (self);
+}
+
+static void on_send_done (gint result, WebConnection* self)
+{
+  self->out.ring_done = TRUE;
+  self->out.ring_op = NULL;
+  self->out.ring_result = result;
+  wakeup (self);
+  g_object_unref (self);
+}
+
+static gssize ring_result (gint result, GError** error)
+{
+  if (result >= 0)
+    return result;
+  else
+    {
+      const GIOErrorEnum code = g_io_error_from_errno (-result);
+      g_set_error_literal (error, G_IO_ERROR, code, g_strerror (-result));
+      return -1;
+    }
+}
+
+static void ring_cancel (WebConnection* self)
+{
+  if (self->in.ring_op != NULL)
+    web_ring_cancel (self->ring, self->in.ring_op);
+  if (self->out.ring_op != NULL)
+    web_ring_cancel (self->ring, self->out.ring_op);
+}
+
+#endif // HAVE_IO_URING
+
+static gssize read_in (WebConnection* self, gpointer block, gsize size, GError** error)
+{
+#ifdef HAVE_IO_URING
+  if (self->ring != NULL)
+    {
+      struct _InputIO* io = & self->in;
+      const gint fd = g_socket_get_fd (self->socket);
+
+      if (io->ring_done == TRUE)
+        return (io->ring_done = FALSE, ring_result (io->ring_result, error));
+
+      /* the receive targets buffer + length, so it is only queued once
+       * every pipelined byte already there has been scanned away */
+      if (io->ring_op != NULL || io->unscanned > 0)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, _("Would block"));
+          return -1;
+        }
+
+      if (io->ring_poll == FALSE)
+        {
+          if ((io->ring_op = web_ring_recv (self->ring, fd, block, size, (WebRingCallback) on_recv_done, self)) != NULL)
+            {
+              g_object_ref (self);
+              g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, _("Would block"));
+              return -1;
+            }
+        }
+
+      /* the submission queue is full (or the ring failed), so read
+       * straight away and, if that would block, let the source poll
+       * the socket until it is readable (see ring_events()) */
+      {
+        GError* tmperr = NULL;
+        gssize read = 0;
+
+        read = g_pollable_input_stream_read_nonblocking (G_POLLABLE_INPUT_STREAM (self->input_stream), block, size, NULL, &tmperr);
+        io->ring_poll = g_error_matches (tmperr, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+
+        if (G_UNLIKELY (tmperr != NULL))
+          g_propagate_error (error, tmperr);
+        return read;
+      }
+    }
+#endif // HAVE_IO_URING
+return g_pollable_input_stream_read_nonblocking (G_POLLABLE_INPUT_STREAM (self->input_stream), block, size, NULL, error);
+}
+
+static gssize write_out (WebConnection* self, const GOutputVector* vectors, gsize n_vectors, GError** error)
+{
+  GPollableReturn result = 0;
+  gsize wrote = 0;
+
+#ifdef HAVE_IO_URING
+  if (self->ring != NULL)
     {
-      if ((io->length + blocksz) > io->allocated)
+      struct _OutputIO* io = & self->out;
+      const gint fd = g_socket_get_fd (self->socket);
+      gsize i;
+
+      if (io->ring_done == TRUE)
+        return (io->ring_done = FALSE, ring_result (io->ring_result, error));
+
+      if (io->ring_op != NULL)
         {
-          io->allocated = io->length + blocksz;
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, _("Would block"));
+          return -1;
+        }
+
+      if (io->ring_poll == FALSE)
+        {
+          /* the kernel reads both while the send is in flight */
+          for (i = 0; i < n_vectors; ++i)
+            {
+              io->ring_iov [i].iov_base = (gpointer) vectors [i].buffer;
+              io->ring_iov [i].iov_len = vectors [i].size;
+            }
+
+          memset (& io->ring_msg, 0, sizeof (io->ring_msg));
+          io->ring_msg.msg_iov = io->ring_iov;
+          io->ring_msg.msg_iovlen = n_vectors;
+
+          if ((io->ring_op = web_ring_sendmsg (self->ring, fd, & io->ring_msg, (WebRingCallback) on_send_done, self)) != NULL)
+            {
+              g_object_ref (self);
+              g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, _("Would block"));
+              return -1;
+            }
+        }
+    }
+#endif // HAVE_IO_URING
+
+  result = g_pollable_output_stream_writev_nonblocking (G_POLLABLE_OUTPUT_STREAM (self->output_stream), vectors, n_vectors, &wrote, NULL, error);
+#ifdef HAVE_IO_URING
+  /* as in read_in(), a send the ring could not take falls back to
+   * polling the socket until it is writable again */
+  self->out.ring_poll = (result == G_POLLABLE_RETURN_WOULD_BLOCK);
+#endif // HAVE_IO_URING
+
+  switch (result)
+    {
+      case G_POLLABLE_RETURN_OK:
+        return (gssize) wrote;
+      case G_POLLABLE_RETURN_WOULD_BLOCK:
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, _("Would block"));
+        return -1;
+      default:
+        return -1;
+    }
+}
+
+static void in_compact (struct _InputIO* io)
+{
+  if (io->offset > 0)
+    {
+      io->length -= io->offset;
+      memmove (io->buffer, G_STRUCT_MEMBER_P (io->buffer, io->offset), io->length);
+      io->offset = 0;
+    }
+}
+
+static void in_fail (struct _InputIO* io, GError* tmperr, GError** error)
+{
+  /* whatever follows a bad request can not be framed reliably,
+   * so nothing else is read; the failure response closes */
+  io->failed = TRUE;
+  io->length = 0;
+  io->offset = 0;
+  io->unscanned = 0;
+
+  g_propagate_error (error, tmperr);
+}
+
+static void in_reserve (struct _InputIO* io, GError** error)
+{
+  if (io->buffer == NULL)
+    {
+      io->allocated = INPUT_BLOCK_MIN;
+      io->buffer = in_buffer_acquire ();
+    }
+  else if (io->length == io->allocated)
+    {
+      /* partial lines are only moved when there is no room
+       * left behind them, growing if that is not enough */
+      if ((in_compact (io), io->length == io->allocated))
+        {
+          /* whatever the configured limits, no request
+           * gets to pin more than a fixed amount */
+          if (io->allocated >= INPUT_BLOCK_LIMIT)
+            {
+              g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_HEADERS_TOO_LARGE, "Request too large for the input buffer");
+              return;
+            }
+
+          io->allocated <<= 1;
           io->buffer = g_realloc (io->buffer, io->allocated);
         }
+    }
+}
+
+static void in_shrink (struct _InputIO* io, gsize used)
+{
+  /* a buffer grown past the minimum is halved once requests
+   * stop needing it; it is never held above the maximum */
+  if (io->allocated > INPUT_BLOCK_MIN && io->length <= (io->allocated >> 1)
+   && (used <= (io->allocated >> 2) || io->allocated > INPUT_BLOCK_MAX))
+    {
+      io->allocated >>= 1;
+      io->buffer = g_realloc (io->buffer, io->allocated);
+    }
+}
+
+static GIOStatus process_in (WebConnection* self, GError** error)
+{
+  struct _InputIO* io = & self->in;
+  GError* tmperr = NULL;
+  gpointer block;
+  gssize read;
+
+  while (TRUE)
+    {
+      if ((in_reserve (io, &tmperr)), G_UNLIKELY (tmperr != NULL))
+        return (in_fail (io, tmperr, error), G_IO_STATUS_ERROR);
 
       block = G_STRUCT_MEMBER_P (io->buffer, io->length);
-      read = g_pollable_input_stream_read_nonblocking (stream, block, blocksz, NULL, &tmperr);
+      read = read_in (self, block, io->allocated - io->length, &tmperr);
 
       if (G_UNLIKELY (tmperr != NULL))
         {
@@ -278,57 +653,141 @@ static GIOStatus process_in (struct _InputIO* io, GPollableInputStream* stream,
             {
               g_error_free (tmperr);
               g_assert (read == -1);
-              break;
+              tmperr = NULL;
+
+              /* Pipelined bytes left behind by the previous request
+               * must be parsed even if the socket has nothing new */
+              if (io->unscanned == 0)
+                break;
+
+              read = 0;
             }
         }
-      else if (read == 0 && io->unscanned == 0)
+
+      if (read == 0 && io->unscanned == 0)
         return G_IO_STATUS_EOF;
       else
         {
-          gchar *line, **frame;
-          guint framesz, linesz, ignore;
+          gchar *eol, *line;
+          guint linesz, ignore;
           gsize unscanned = io->unscanned;
-          gsize i, j, last = 0;
+          gsize i, used;
+
+          io->uptime = g_get_monotonic_time ();
+
+          if (io->length == 0 && read > 0)
+            io->started = io->uptime;
 
           io->length += read;
           io->unscanned = 0;
-          io->uptime = g_get_monotonic_time ();
 
-          for (i = (io->length - unscanned - read); i < io->length; ++i)
+          /* memchr() is vectorized by the C library, so line
+           * ends are found a word or more at a time */
+          for (i = (io->length - unscanned - read); i < io->length; i = io->offset)
             {
-              if (G_STRUCT_MEMBER (gchar, io->buffer, i) == '\n')
+              if ((eol = memchr (G_STRUCT_MEMBER_P (io->buffer, i), '\n', io->length - i)) == NULL)
+                break;
+
+              i = eol - (gchar*) io->buffer;
+              ignore = (i > io->offset && G_STRUCT_MEMBER (gchar, io->buffer, i - 1) == '\r') ? 1 : 0;
+              linesz = (i - io->offset) - ignore;
+              line = & G_STRUCT_MEMBER (gchar, io->buffer, io->offset);
+              io->offset = i + 1;
+
+              if ((web_parser_feed (& io->parser, line, linesz, &tmperr)), G_UNLIKELY (tmperr != NULL))
+                return (in_fail (io, tmperr, error), G_IO_STATUS_ERROR);
+              else if (io->parser.complete == TRUE)
                 {
-                  ignore = (i > 0 && G_STRUCT_MEMBER (gchar, io->buffer, i - 1) == '\r') ? 1 : 0;
-                  linesz = (i - last) - ignore;
-                  line = & G_STRUCT_MEMBER (gchar, io->buffer, last);
-                  last = i + 1;
+                  used = io->offset;
+                  io->started = io->uptime;
+                  io->unscanned = io->length - io->offset;
 
-                  if ((web_parser_feed (& io->parser, line, linesz, &tmperr)), G_UNLIKELY (tmperr != NULL))
-                    {
-                      g_propagate_error (error, tmperr);
-                      return G_IO_STATUS_ERROR;
-                    }
-                  else if (io->parser.complete == TRUE)
-                    {
-                      io->unscanned = io->length - i - 1;
-                      io->length -= last;
-
-                      memmove (io->buffer, io->buffer + last, io->length);
-                      return G_IO_STATUS_NORMAL;
-                    }
+                  in_compact (io);
+                  in_shrink (io, used);
+                  return G_IO_STATUS_NORMAL;
                 }
             }
 
-          if (last > 0)
-            {
-              io->length -= last;
-              memmove (io->buffer, io->buffer + last, io->length);
-            }
+          if ((web_parser_check (& io->parser, io->length - io->offset, &tmperr)), G_UNLIKELY (tmperr != NULL))
+            return (in_fail (io, tmperr, error), G_IO_STATUS_ERROR);
         }
     }
 return (io->parser.complete == FALSE) ? G_IO_STATUS_AGAIN : G_IO_STATUS_NORMAL;
 }
 
+static void date_format (gchar* buffer, gint64 second)
+{
+  static const gchar days [7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", };
+  static const gchar months [12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec", };
+  time_t time = (time_t) second;
+  struct tm tm;
+
+  /* IMF-fixdate, spelled out by hand so locale never gets in */
+  gmtime_r (&time, &tm);
+  g_snprintf (buffer, DATE_LENGTH + 1, "Date: %s, %02d %s %04d %02d:%02d:%02d GMT\r\n",
+    days [tm.tm_wday], tm.tm_mday, months [tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+static void date_peek (gchar* buffer)
+{
+  static gsize line [DATE_WORDS];
+  static gsize shown = 0;
+  static guint sequence = 0;
+  static GMutex lock;
+  gsize words [DATE_WORDS];
+  gsize second, seen;
+  guint begin, i;
+
+  /* the Date line is formatted once per second under a sequence count
+   * which is odd while it is being written; readers copy it out and
+   * retry if the count moved meanwhile (a seqlock), so a copy is never
+   * torn and readers never wait on each other; both sides go through
+   * the line a machine word at a time with atomic loads and stores, so
+   * a reader overlapping the writer only ever throws its copy away */
+  second = (gsize) (g_get_real_time () / G_USEC_PER_SEC);
+
+  do
+    {
+      while ((begin = g_atomic_int_get (&sequence)) & 1);
+
+      for (i = 0; i < DATE_WORDS; ++i)
+        words [i] = (gsize) g_atomic_pointer_get (& line [i]);
+      seen = (gsize) g_atomic_pointer_get (&shown);
+    }
+  while (g_atomic_int_get (&sequence) != begin);
+
+  memcpy (buffer, words, DATE_LENGTH);
+
+  if (seen != second)
+    {
+      /* losing the race just means sending the previous
+       * second's line, unless there is none yet */
+      if (seen == 0)
+        g_mutex_lock (&lock);
+      else if (g_mutex_trylock (&lock) == FALSE)
+        return;
+
+      /* writers only run under the lock, so
+       * this one may read the line directly */
+      if (shown == second)
+        memcpy (words, line, sizeof (words));
+      else
+        {
+          date_format ((gchar*) words, second);
+          g_atomic_int_inc (&sequence);
+
+          for (i = 0; i < DATE_WORDS; ++i)
+            g_atomic_pointer_set (& line [i], words [i]);
+
+          g_atomic_pointer_set (&shown, second);
+          g_atomic_int_inc (&sequence);
+        }
+
+      memcpy (buffer, words, DATE_LENGTH);
+      g_mutex_unlock (&lock);
+    }
+}
+
 static gpointer allocout (struct _OutputIO* io, gsize needed)
 {
   if ((io->length + needed) > io->allocated)
@@ -339,20 +798,62 @@ static gpointer allocout (struct _OutputIO* io, gsize needed)
 return G_STRUCT_MEMBER_P (io->buffer, io->length);
 }
 
-static void printout (struct _OutputIO* io, const gchar* fmt, ...)
+static const gchar* static_block (gboolean is_closure, gsize* length)
 {
-  va_list try, list;
-  gsize needed, wrote;
-  gpointer block;
+  static gchar blocks [2][256];
+  static gsize lengths [2];
+  static gsize __value__ = 0;
+
+  /* the headers every response carries and that never change
+   * while the server runs, laid out once as wire bytes (the
+   * Keep-Alive line is per connection, see web_connection_set_limits) */
+  if (g_once_init_enter (&__value__))
+    {
+      lengths [0] = g_snprintf (blocks [0], sizeof (blocks [0]),
+        "Connection: Keep-Alive\r\n"
+        "Server: " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n");
+      lengths [1] = g_snprintf (blocks [1], sizeof (blocks [1]),
+        "Connection: Close\r\n"
+        "Server: " PACKAGE_NAME "/" PACKAGE_VERSION "\r\n");
+      g_once_init_leave (&__value__, 1);
+    }
+return (*length = lengths [is_closure ? 1 : 0], blocks [is_closure ? 1 : 0]);
+}
 
-  va_start (try, fmt);
-  G_VA_COPY (list, try);
+static const gchar* status_line (WebHttpVersion http_version, WebStatusCode status_code, gsize* length)
+{
+  static gchar* lines [WEB_HTTP_VERSION_2_0 + 1][WEB_STATUS_CODE_MAX] = {0};
+  static guint8 lengths [WEB_HTTP_VERSION_2_0 + 1][WEB_STATUS_CODE_MAX] = {0};
+  static gsize __value__ = 0;
+  const gchar* reason = NULL;
+  guint code, version;
+
+  /* every known status line is formatted once, for every version,
+   * so a response starts with a table lookup and a memcpy () */
+  if (g_once_init_enter (&__value__))
+    {
+      for (version = WEB_HTTP_VERSION_0_9; version <= WEB_HTTP_VERSION_2_0; ++version)
+      for (code = 100; code < WEB_STATUS_CODE_MAX; ++code)
+        {
+          if ((reason = web_status_code_get_inline (code)) != NULL)
+            {
+              lines [version][code] = g_strdup_printf ("HTTP/%s %u %s\r\n", web_http_version_to_string (version), code, reason);
+              lengths [version][code] = strlen (lines [version][code]);
+            }
+        }
+
+      g_once_init_leave (&__value__, 1);
+    }
 
-  needed = g_printf_string_upper_bound (fmt, try);
-  block = allocout (io, needed);
-  wrote = g_vsnprintf (block, io->allocated, fmt, list);
-  io->length += wrote;
-return (va_end (try), va_end (list), (void) wrote);
+  if ((guint) http_version > WEB_HTTP_VERSION_2_0 || (guint) status_code >= WEB_STATUS_CODE_MAX)
+    return NULL;
+return (*length = lengths [http_version][status_code], lines [http_version][status_code]);
+}
+
+static void writeout (struct _OutputIO* io, gconstpointer data, gsize length)
+{
+  memcpy (allocout (io, length), data, length);
+  io->length += length;
 }
 
 static void serialize (struct _OutputIO* io, WebMessage* web_message)
@@ -362,133 +863,347 @@ static void serialize (struct _OutputIO* io, WebMessage* web_message)
   WebMessageHeaders* headers = NULL;
   WebMessageHeadersIter iter = {0};
   WebStatusCode status_code = 0;
-  GDateTime* datetime = NULL;
+  GInputStream* stream = NULL;
   GIOStatus status = 0;
   GList *list, *values = NULL;
   gboolean is_closure = FALSE;
+  const gchar* block = NULL;
   const gchar* key = NULL;
   gsize length = 0;
 
-  datetime = g_date_time_new_now_utc ();
   http_version = web_message_get_http_version (web_message);
   is_closure = web_message_get_is_closure (web_message);
   status_code = web_message_get_status (web_message);
 
   g_object_get (web_message, "response-body", &body, "response-headers", &headers, NULL);
-  web_message_headers_replace_take (headers, g_strdup (WEB_MESSAGE_FIELD_CONNECTION), g_strdup (is_closure ? "Close" : "Keep-Alive"));
-  web_message_headers_replace_take (headers, g_strdup (WEB_MESSAGE_FIELD_DATE), g_date_time_format (datetime, "%a, %d %b %Y %T GMT"));
-  web_message_headers_replace_take (headers, g_strdup (WEB_MESSAGE_FIELD_SERVER), g_strdup (PACKAGE_NAME "/" PACKAGE_VERSION));
-  if (is_closure == FALSE)
-  web_message_headers_replace_take (headers, g_strdup (WEB_MESSAGE_FIELD_KEEP_ALIVE), g_strdup_printf ("timeout=%u", keepalive_timeout_secs));
+  web_message_headers_remove_field (headers, WEB_MESSAGE_FIELD_ID_CONNECTION);
+  web_message_headers_remove_field (headers, WEB_MESSAGE_FIELD_ID_DATE);
+  web_message_headers_remove_field (headers, WEB_MESSAGE_FIELD_ID_KEEP_ALIVE);
+  web_message_headers_remove_field (headers, WEB_MESSAGE_FIELD_ID_SERVER);
   web_message_headers_iter_init (&iter, headers);
 
   io->is_closure = is_closure;
-  io->splice = g_object_ref (G_POLLABLE_INPUT_STREAM (web_message_body_get_stream (body)));
+  io->splice = (stream = web_message_body_get_stream (body)) == NULL ? NULL : g_object_ref (G_POLLABLE_INPUT_STREAM (stream));
+
+  for (list = web_message_body_get_chunks (body); list; list = list->next)
+    {
+      WebMessageChunk* chunk = list->data;
+      GBytes* bytes = (chunk->bytes == NULL) ? NULL : g_bytes_ref (chunk->bytes);
+
+      g_queue_push_tail (& io->chunks, chunk_new (bytes, chunk->offset, chunk->length));
+    }
+
+  /* file chunks refer to the body's descriptor, so the body
+   * is kept around until all of them have been sent */
+  _web_message_body_unref0 (io->body);
+  io->body = web_message_body_ref (body);
+  io->fd = web_message_body_get_fd (body);
 
-  printout (io, "HTTP/%s %i %s\r\n", web_http_version_to_string (http_version), status_code, web_status_code_get_inline (status_code));
+  if ((block = status_line (http_version, status_code, &length)) != NULL)
+    writeout (io, block, length);
+  else
+    {
+      gchar buffer [64];
+
+      /* codes without a reason phrase are rare enough to format */
+      length = g_snprintf (buffer, sizeof (buffer), "HTTP/%s %u \r\n", web_http_version_to_string (http_version), (guint) status_code);
+      writeout (io, buffer, length);
+    }
 
   while (web_message_headers_iter_next (&iter, &key, &values))
     {
+      writeout (io, key, strlen (key));
+
       for (list = values; list; list = list->next)
         {
-          if (list == values)
-            printout (io, "%s: %s", key, list->data);
-          else
-            printout (io, ", %s", list->data);
+          writeout (io, list == values ? ": " : ", ", 2);
+          writeout (io, list->data, strlen (list->data));
         }
 
-      printout (io, "\r\n");
+      writeout (io, "\r\n", 2);
     }
 
+  block = static_block (is_closure, &length);
+
+  date_peek (allocout (io, DATE_LENGTH));
+  io->length += DATE_LENGTH;
+  writeout (io, block, length);
+
+  if (is_closure == FALSE)
+    writeout (io, io->keepalive, io->keepalive_length);
+  writeout (io, "\r\n", 2);
+
   web_message_body_unref (body);
   web_message_headers_unref (headers);
-  printout (io, "\r\n");
 }
 
-static GIOStatus process_out (struct _OutputIO* io, GPollableOutputStream* stream, GError** error)
+static gboolean has_unwritten (struct _OutputIO* io)
+{
+  return io->wrote < io->length || io->chunks.length > 0;
+}
+
+static gsize collect (struct _OutputIO* io, GOutputVector* vectors, gsize n_vectors)
 {
-  const goffset blocksz = 256;
+  GList* list = io->chunks.head;
+  WebMessageChunk* chunk = NULL;
+  gsize i = 0, offset = io->chunk_offset;
 
-  if (io->wrote == io->length)
+  if (io->wrote < io->length)
+    {
+      vectors [i].buffer = G_STRUCT_MEMBER_P (io->buffer, io->wrote);
+      vectors [i].size = io->length - io->wrote;
+      ++i;
+    }
+
+  /* a file chunk ends the vector, it goes through sendfile() */
+  for (; i < n_vectors && list && (chunk = list->data)->bytes != NULL; list = list->next, offset = 0, ++i)
+    {
+      vectors [i].buffer = G_STRUCT_MEMBER_P (g_bytes_get_data (chunk->bytes, NULL), chunk->offset + offset);
+      vectors [i].size = chunk->length - offset;
+    }
+return i;
+}
+
+static void advance (struct _OutputIO* io, gsize wrote)
+{
+  WebMessageChunk* chunk = NULL;
+  gsize size = MIN (wrote, io->length - io->wrote);
+
+  io->wrote += size;
+  wrote -= size;
+
+  while (wrote > 0 && (chunk = g_queue_peek_head (& io->chunks)) != NULL)
+    {
+      if ((size = chunk->length - io->chunk_offset) > wrote)
+        {
+          io->chunk_offset += wrote;
+          break;
+        }
+
+      chunk_free (g_queue_pop_head (& io->chunks));
+      io->chunk_offset = 0;
+      wrote -= size;
+    }
+}
+
+static gboolean can_sendfile (WebConnection* self)
+{
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+  return self->is_https == FALSE;
+#else // !HAVE_SENDFILE
+  return FALSE;
+#endif // HAVE_SENDFILE
+}
+
+static void materialize (struct _OutputIO* io, gsize blocksz, GError** error)
+{
+  WebMessageChunk* chunk = g_queue_peek_head (& io->chunks);
+  const goffset offset = chunk->offset + io->chunk_offset;
+  const gsize size = (gsize) MIN ((goffset) blocksz, chunk->length - io->chunk_offset);
+  gpointer block = g_malloc (size);
+  gssize read;
+
+  do read = pread (io->fd, block, size, offset);
+  while (G_UNLIKELY (read < 0 && errno == EINTR));
+
+  if (G_UNLIKELY (read <= 0))
+    {
+      const int errsv = errno;
+
+      if (read == 0)
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, _("File shrunk while being sent"));
+      else
+        g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv), g_strerror (errsv));
+      g_free (block);
+    }
+  else
+    {
+      chunk->offset = offset + read;
+      chunk->length -= io->chunk_offset + read;
+      io->chunk_offset = 0;
+
+      if (chunk->length == 0)
+        chunk_free (g_queue_pop_head (& io->chunks));
+      g_queue_push_head (& io->chunks, chunk_new (g_bytes_new_take (block, read), 0, read));
+    }
+}
+
+static gssize sendfile_out (WebConnection* self, goffset offset, goffset length, GError** error)
+{
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+  const gint fd = g_socket_get_fd (self->socket);
+  const gsize count = (gsize) MIN (length, (goffset) (1 << 30));
+  off_t off = (off_t) offset;
+  gssize sent;
+
+#ifdef HAVE_IO_URING
+  if (self->ring != NULL)
+    {
+      struct _OutputIO* io = & self->out;
+
+      if (io->ring_done == TRUE)
+        {
+          /* the socket became writable (or failed) */
+          if ((io->ring_done = FALSE), io->ring_result < 0)
+            return ring_result (io->ring_result, error);
+        }
+      else if (io->ring_op != NULL)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, _("Would block"));
+          return -1;
+        }
+    }
+#endif // HAVE_IO_URING
+
+  do sent = sendfile (fd, self->out.fd, &off, count);
+  while (G_UNLIKELY (sent < 0 && errno == EINTR));
+
+#ifdef HAVE_IO_URING
+  self->out.ring_poll = FALSE;
+#endif // HAVE_IO_URING
+
+  if (G_UNLIKELY (sent < 0))
+    {
+      const int errsv = errno;
+
+#ifdef HAVE_IO_URING
+      if (self->ring != NULL && (errsv == EAGAIN || errsv == EWOULDBLOCK))
+        {
+          if ((self->out.ring_op = web_ring_poll (self->ring, fd, G_IO_OUT, (WebRingCallback) on_send_done, self)) != NULL)
+            g_object_ref (self);
+          else
+            self->out.ring_poll = TRUE;
+        }
+#endif // HAVE_IO_URING
+
+      g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errsv), g_strerror (errsv));
+      return -1;
+    }
+
+  /* the file ended before the length promised on the header, the
+   * socket stays writable so retrying would only spin on it */
+  if (G_UNLIKELY (sent == 0 && count > 0))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, _("File shrunk while being sent"));
+      return -1;
+    }
+return sent;
+#else // !HAVE_SENDFILE
+  g_assert_not_reached ();
+#endif // HAVE_SENDFILE
+}
+
+static GIOStatus process_out (WebConnection* self, GError** error)
+{
+  struct _OutputIO* io = & self->out;
+  GOutputVector vectors [16];
+  GError* tmperr = NULL;
+  gsize n_vectors;
+  gssize wrote;
+  guint i;
+
+  const gsize blocksz = 16384;
+  const guint blocksn = 4;
+
+  if (has_unwritten (io) == FALSE)
     {
       io->length = 0;
       io->wrote = 0;
 
       if (io->splice != NULL)
         {
-          while (TRUE)
+          /* streamed bodies are read into chunks of their own, which
+           * then go out in the same writev() as everything queued */
+          for (i = 0; i < blocksn && io->splice != NULL; ++i)
             {
-              GError* tmperr = NULL;
-              gpointer block = NULL;
+              gpointer block = g_malloc (blocksz);
               gssize read = 0;
 
-              if ((io->length + blocksz) > io->allocated)
-                {
-                  io->allocated = io->length + blocksz;
-                  io->buffer = g_realloc (io->buffer, io->allocated);
-                }
-
-              block = G_STRUCT_MEMBER_P (io->buffer, io->length);
-              read = g_pollable_input_stream_read_nonblocking (io->splice, block, blocksz, NULL, &tmperr);
-
-              if (G_UNLIKELY (tmperr == NULL))
+              if ((read = g_pollable_input_stream_read_nonblocking (io->splice, block, blocksz, NULL, &tmperr)), G_UNLIKELY (tmperr == NULL))
                 {
                   if (read > 0)
-                    io->length += read;
+                    g_queue_push_tail (& io->chunks, chunk_new (g_bytes_new_take (block, read), 0, read));
                   else
                     {
                       _g_object_unref0 (io->splice);
-                      break;
+                      g_free (block);
                     }
                 }
               else
                 {
+                  g_free (block);
+
                   if (!g_error_matches (tmperr, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
                     return (g_propagate_error (error, tmperr), G_IO_STATUS_ERROR);
                   else
                     {
                       g_error_free (tmperr);
                       g_assert (read == -1);
+                      tmperr = NULL;
                       break;
                     }
                 }
             }
         }
-      else if (io->is_closure == TRUE)
-        {
-          return G_IO_STATUS_EOF;
-        }
-      else if (g_mutex_trylock (& io->lock))
+      else
         {
-          struct _Frame* frame = NULL;
+          WebMessage** slot = & io->ring [(io->seqidp + 1) & (OUTPUT_RING_SIZE - 1)];
+          WebMessage* web_message = NULL;
 
-          if ((frame = g_queue_peek_head (& io->queue)) == NULL)
-            g_mutex_unlock (& io->lock);
-          else if (((frame->seqid == 0) || ((frame->seqid - 1) == io->seqidp)) == FALSE)
-            g_mutex_unlock (& io->lock);
-          else
-            {
-              io->seqidp = (frame->seqid == 0) ? io->seqidp : frame->seqid;
+          _web_message_body_unref0 (io->body);
+          io->fd = -1;
+
+          if (io->is_closure == TRUE)
+            return G_IO_STATUS_EOF;
 
-              g_queue_pop_head (& io->queue);
+          /* unordered (seqid 0) responses are rare, only take the lock
+           * when one has been queued */
+          if (g_atomic_int_get (& io->n_oob) > 0 && g_mutex_trylock (& io->lock))
+            {
+              if ((web_message = g_queue_pop_head (& io->oob)) != NULL)
+                g_atomic_int_dec_and_test (& io->n_oob);
               g_mutex_unlock (& io->lock);
+            }
+
+          if (web_message == NULL && (web_message = g_atomic_pointer_get (slot)) != NULL)
+            {
+              g_atomic_pointer_set (slot, NULL);
+              io->seqidp += 1;
+            }
 
-              serialize (io, frame->web_message);
-              frame_free (frame);
+          if (web_message != NULL)
+            {
+              serialize (io, web_message);
+              _web_message_release (web_message);
+              io->uptime = g_get_monotonic_time ();
             }
         }
     }
-  else while (TRUE)
+
+  if (has_unwritten (io) == TRUE)
     {
-      GError* tmperr = NULL;
-      gpointer block = NULL;
-      gsize wrote = 0;
+      if ((n_vectors = collect (io, vectors, G_N_ELEMENTS (vectors))) == 0 && can_sendfile (self) == FALSE)
+        {
+          if ((materialize (io, blocksz, &tmperr)), G_UNLIKELY (tmperr != NULL))
+            return (g_propagate_error (error, tmperr), G_IO_STATUS_ERROR);
+          n_vectors = collect (io, vectors, G_N_ELEMENTS (vectors));
+        }
 
-      block = G_STRUCT_MEMBER_P (io->buffer, io->wrote);
-      wrote = g_pollable_output_stream_write_nonblocking (stream, block, io->length - io->wrote, NULL, &tmperr);
+      if (n_vectors > 0)
+        wrote = write_out (self, vectors, n_vectors, &tmperr);
+      else
+        {
+          WebMessageChunk* chunk = g_queue_peek_head (& io->chunks);
+          wrote = sendfile_out (self, chunk->offset + io->chunk_offset, chunk->length - io->chunk_offset, &tmperr);
+        }
 
       if (G_UNLIKELY (tmperr == NULL))
-        io->wrote += wrote;
+        {
+          advance (io, wrote);
+
+          if (wrote > 0)
+            io->uptime = g_get_monotonic_time ();
+        }
       else
         {
           if (!g_error_matches (tmperr, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
@@ -497,22 +1212,37 @@ static GIOStatus process_out (struct _OutputIO* io, GPollableOutputStream* strea
             {
               g_error_free (tmperr);
               g_assert (wrote == -1);
-              break;
             }
         }
-
-      break;
     }
-return (io->length > io->wrote) ? G_IO_STATUS_AGAIN : G_IO_STATUS_NORMAL;
+return has_unwritten (io) ? G_IO_STATUS_AGAIN : G_IO_STATUS_NORMAL;
 }
 
 static void on_message_thawed (WebMessage* web_message, guint freeze_count, WebConnection* web_connection)
 {
-  if (freeze_count == 0)
+  /* only the side which takes the handler off sends, see below */
+  if (freeze_count == 0 && g_signal_handlers_disconnect_by_data (web_message, web_connection) > 0)
+    web_connection_send (web_connection, web_message);
+}
+
+guint web_connection_reserve (WebConnection* web_connection, GError** error)
+{
+  g_return_val_if_fail (WEB_IS_CONNECTION (web_connection), 0);
+  g_return_val_if_fail (error == NULL || *error == NULL, 0);
+  WebConnection* self = (web_connection);
+
+  /* takes the seqid a next request would have had, so a response not
+   * tied to a parsed one (a parse failure) goes out after those still
+   * in flight; called from the connection's context, as step() is */
+  if (self->http_version >= WEB_HTTP_VERSION_2_0 || self->out.seqidn == G_MAXUINT)
+    return 0;
+  /* each seqid in flight owns a ring slot, see web_connection_send () */
+  else if ((self->out.seqidn - self->out.seqidp) >= OUTPUT_RING_SIZE)
     {
-      g_signal_handlers_disconnect_by_data (web_message, web_connection);
-      web_connection_send (web_connection, web_message);
+      g_set_error_literal (error, WEB_CONNECTION_ERROR, WEB_CONNECTION_ERROR_REQUEST_OVERFLOW, _("Too much responses in flight for connection"));
+      return 0;
     }
+return ++self->out.seqidn;
 }
 
 void web_connection_send (WebConnection* web_connection, WebMessage* web_message)
@@ -520,19 +1250,310 @@ void web_connection_send (WebConnection* web_connection, WebMessage* web_message
   g_return_if_fail (WEB_IS_CONNECTION (web_connection));
   g_return_if_fail (WEB_IS_MESSAGE (web_message));
   WebConnection* self = (web_connection);
-  struct _Frame* frame = NULL;
+  WebMessage** slot = NULL;
+  guint seqid;
 
   if (_web_message_get_freeze_count (web_message) > 0)
-    g_signal_connect_object (web_message, "thawed", G_CALLBACK (on_message_thawed), web_connection, 0);
+    {
+      g_signal_connect_object (web_message, "thawed", G_CALLBACK (on_message_thawed), web_connection, 0);
+
+      /* the last thaw may have come from another thread before
+       * the handler was connected; disconnecting is atomic, so
+       * either it or on_message_thawed () gets to send, never both */
+      if (_web_message_get_freeze_count (web_message) == 0 && g_signal_handlers_disconnect_by_data (web_message, web_connection) > 0)
+        web_connection_send (web_connection, web_message);
+    }
+  else
+    {
+      if ((seqid = _web_message_get_seqid (web_message)) == 0)
+        {
+          g_mutex_lock (& self->out.lock);
+          g_queue_push_tail (& self->out.oob, g_object_ref (web_message));
+          g_atomic_int_inc (& self->out.n_oob);
+          g_mutex_unlock (& self->out.lock);
+        }
+      else
+        {
+          /* at most limits.max_pipelined (<= OUTPUT_RING_SIZE) requests are in
+           * flight (see is_saturated), so each seqid owns its slot */
+          slot = & self->out.ring [seqid & (OUTPUT_RING_SIZE - 1)];
+
+          g_assert (g_atomic_pointer_get (slot) == NULL);
+          g_atomic_pointer_set (slot, g_object_ref (web_message));
+        }
+
+      wakeup (self);
+    }
+}
+
+void web_connection_set_limits (WebConnection* web_connection, const WebConnectionLimits* limits)
+{
+  g_return_if_fail (WEB_IS_CONNECTION (web_connection));
+  g_return_if_fail (limits != NULL);
+  g_return_if_fail (limits->max_pipelined > 0 && limits->max_pipelined <= WEB_CONNECTION_MAX_PIPELINED);
+  g_return_if_fail (limits->max_requests > 0);
+  WebConnection* self = (web_connection);
+
+  self->limits = *limits;
+  self->in.parser.max_header_bytes = limits->max_header_bytes;
+  self->in.parser.max_header_count = limits->max_header_count;
+  self->in.parser.max_header_length = limits->max_header_length;
+  self->in.parser.max_request_line = limits->max_request_line;
+  self->out.keepalive_length = g_snprintf (self->out.keepalive, sizeof (self->out.keepalive), "Keep-Alive: timeout=%u\r\n", limits->keepalive_timeout);
+}
+
+static gboolean is_idle (WebConnection* self)
+{
+  return self->out.seqidp == self->out.seqidn && has_unwritten (& self->out) == FALSE && self->out.splice == NULL;
+}
+
+static gboolean is_saturated (WebConnection* self)
+{
+  /* past max_requests nothing else is parsed, the last request
+   * answered closes the connection */
+  if (self->out.seqidn >= self->limits.max_requests)
+    return TRUE;
+return (self->out.seqidn - self->out.seqidp) >= self->limits.max_pipelined;
+}
+
+static gboolean is_pending (WebConnection* self)
+{
+  WebMessage** slot = & self->out.ring [(self->out.seqidp + 1) & (OUTPUT_RING_SIZE - 1)];
+  gboolean ready = FALSE;
+
+  if (self->out.splice != NULL)
+    ready = g_pollable_input_stream_is_readable (self->out.splice);
+  else if (self->out.is_closure == TRUE)
+    ready = TRUE;
   else
+    ready = g_atomic_int_get (& self->out.n_oob) > 0 || g_atomic_pointer_get (slot) != NULL;
+return ready || (self->in.unscanned > 0 && is_saturated (self) == FALSE);
+}
+
+static void schedule (WebConnection* self)
+{
+  gint64 deadline;
+
+  /* a single timer per connection, re-armed after every step
+   * with whichever deadline currently applies */
+  if (has_unwritten (& self->out))
+    deadline = self->out.uptime + (gint64) write_timeout_secs * G_USEC_PER_SEC;
+  else if (is_idle (self) == FALSE)
+    {
+      /* requests in flight are up to their handlers, and
+       * whatever is buffered behind them waits with them */
+      web_timer_cancel (& self->timer);
+      return;
+    }
+  else if (self->in.length > 0)
     {
-      frame = g_slice_new (struct _Frame);
-      frame->web_message = g_object_ref (web_message);
-      frame->seqid_ptr = g_object_get_qdata (G_OBJECT (web_message), seqid_quark ());
+      /* with nothing in flight anything buffered has been scanned, so it
+       * is a partial request; its clock starts no earlier than the last
+       * response went out, the client may have sent it while waiting */
+      deadline = MAX (self->in.started, self->out.uptime) + (gint64) header_timeout_secs * G_USEC_PER_SEC;
+    }
+  else
+    deadline = self->in.uptime + (gint64) self->limits.keepalive_timeout * G_USEC_PER_SEC;
 
-      g_mutex_lock (& self->out.lock);
-      g_queue_insert_sorted (& self->out.queue, frame, frame_cmp, NULL);
-      g_mutex_unlock (& self->out.lock);
+  web_timer_wheel_arm (self->wheel, & self->timer, deadline);
+}
+
+#ifdef HAVE_IO_URING
+
+static GIOCondition ring_events (WebConnection* self)
+{
+  if (has_unwritten (& self->out))
+    return self->out.ring_poll ? G_IO_OUT : 0;
+  else
+    return (self->in.ring_poll && self->in.failed == FALSE) ? G_IO_IN : 0;
+}
+
+static gboolean is_ring_ready (WebConnection* self)
+{
+  /* a direction falling back to socket polling has nothing to submit
+   * until the socket is ready, which the source check looks after */
+  if (self->in.ring_done || self->out.ring_done)
+    return TRUE;
+  else if (has_unwritten (& self->out))
+    return self->out.ring_op == NULL && self->out.ring_poll == FALSE;
+  else
+    return is_pending (self) || (self->in.ring_op == NULL && self->in.ring_poll == FALSE && self->in.failed == FALSE);
+}
+
+static gboolean web_connection_source_prepare_ring (GSource* pself, gint* timeout)
+{
+  WebConnectionSource* self = (gpointer) pself;
+  WebConnection* web_connection = self->web_connection;
+  GIOCondition events = ring_events (web_connection);
+
+  /* completions arrive through the worker's ring, which wakes this
+   * source up, so the socket itself is only polled while the ring
+   * could not take a submission */
+  if (events == 0)
+    {
+      if (self->tag != NULL)
+        {
+          g_source_remove_unix_fd (pself, self->tag);
+          self->tag = NULL;
+        }
+    }
+  else if (self->tag == NULL)
+    self->tag = g_source_add_unix_fd (pself, g_socket_get_fd (web_connection->socket), (self->events = events));
+  else if (self->events != events)
+    g_source_modify_unix_fd (pself, self->tag, (self->events = events));
+return is_ring_ready (web_connection);
+}
+
+#endif // HAVE_IO_URING
+
+static gboolean web_connection_source_prepare (GSource* pself, gint* timeout)
+{
+  WebConnectionSource* self = (gpointer) pself;
+  WebConnection* web_connection = self->web_connection;
+  GIOCondition events = G_IO_IN;
+  gboolean ready = FALSE;
+
+  /* deadlines are kept by the worker's timer wheel */
+  *timeout = -1;
+
+#ifdef HAVE_IO_URING
+  if (web_connection->ring != NULL)
+    return web_connection_source_prepare_ring (pself, timeout);
+#endif // HAVE_IO_URING
+
+  if (has_unwritten (& web_connection->out))
+    events = G_IO_OUT;
+  else
+    {
+      if (web_connection->in.failed == TRUE)
+        events = 0;
+
+      ready = is_pending (web_connection);
+    }
+
+  if (self->events != events)
+    {
+      /* g_source_modify_unix_fd() wakes up the context, so only
+       * do it when the interest set actually changes */
+      g_source_modify_unix_fd (pself, self->tag, (self->events = events));
+    }
+return ready;
+}
+
+static gboolean web_connection_source_check (GSource* pself)
+{
+  WebConnectionSource* self = (gpointer) pself;
+  WebConnection* web_connection = self->web_connection;
+
+#ifdef HAVE_IO_URING
+  if (web_connection->ring != NULL)
+    return is_ring_ready (web_connection) || (self->tag != NULL && g_source_query_unix_fd (pself, self->tag) != 0);
+#endif // HAVE_IO_URING
+
+  if (g_source_query_unix_fd (pself, self->tag) != 0)
+    return TRUE;
+  else if (has_unwritten (& web_connection->out))
+    return FALSE;
+  else
+    return is_pending (web_connection);
+}
+
+static gboolean web_connection_source_dispatch (GSource* pself, GSourceFunc callback, gpointer user_data)
+{
+  WebConnectionSource* self = (gpointer) pself;
+  WebConnectionSourceFunc func = (WebConnectionSourceFunc) callback;
+
+  if (G_UNLIKELY (func == NULL))
+    {
+      g_warning ("WebConnection source dispatched without callback. You must call g_source_set_callback().");
+      return G_SOURCE_REMOVE;
+    }
+
+  /* reset before calling back so a concurrent web_connection_send() is never lost */
+  g_source_set_ready_time (pself, -1);
+return func (self->web_connection, user_data);
+}
+
+static void web_connection_source_dispose (GSource* pself)
+{
+  WebConnectionSource* self = (gpointer) pself;
+  WebConnection* web_connection = self->web_connection;
+
+  g_mutex_lock (& web_connection->out.lock);
+
+  if (web_connection->source == pself)
+    web_connection->source = NULL;
+
+  g_mutex_unlock (& web_connection->out.lock);
+}
+
+static void web_connection_source_finalize (GSource* pself)
+{
+  WebConnectionSource* self = (gpointer) pself;
+  _g_object_unref0 (self->web_connection);
+}
+
+static GSourceFuncs web_connection_source_funcs =
+{
+  .prepare = web_connection_source_prepare,
+  .check = web_connection_source_check,
+  .dispatch = web_connection_source_dispatch,
+  .finalize = web_connection_source_finalize,
+};
+
+GSource* web_connection_create_source (WebConnection* web_connection)
+{
+  g_return_val_if_fail (WEB_IS_CONNECTION (web_connection), NULL);
+  WebConnection* self = (web_connection);
+  WebConnectionSource* source = NULL;
+  GSource* pself = NULL;
+
+  pself = g_source_new (& web_connection_source_funcs, sizeof (WebConnectionSource));
+  source = (gpointer) pself;
+  source->events = G_IO_IN;
+  source->tag = g_source_add_unix_fd (pself, g_socket_get_fd (self->socket), source->events);
+  source->web_connection = g_object_ref (self);
+
+  g_source_set_dispose_function (pself, web_connection_source_dispose);
+  g_source_set_priority (pself, G_PRIORITY_DEFAULT);
+#if GLIB_CHECK_VERSION(2, 70, 0)
+  g_source_set_static_name (pself, "[WebConnection.Source]");
+#else // GLIB_CHECK_VERSION(2, 70, 0)
+  g_source_set_name (pself, "[WebConnection.Source]");
+#endif // GLIB_CHECK_VERSION(2, 70, 0)
+
+  g_mutex_lock (& self->out.lock);
+  g_assert (self->source == NULL);
+  self->source = pself;
+  g_mutex_unlock (& self->out.lock);
+return pself;
+}
+
+static void close_io (WebConnection* self, GError** error)
+{
+#ifdef HAVE_IO_URING
+  ring_cancel (self);
+#endif // HAVE_IO_URING
+  web_timer_cancel (& self->timer);
+
+  self->in.closed = TRUE;
+  self->out.closed = TRUE;
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED, _("Connection closed"));
+}
+
+static void fail_io (WebConnection* self, GError* tmperr, GError** error)
+{
+  /* a request that could not be parsed is still answered, any other
+   * failure (a reset, a broken pipe) leaves nobody to talk to, and the
+   * socket would keep the source dispatching if it stayed open */
+  if (tmperr->domain == WEB_PARSER_ERROR || tmperr->domain == WEB_CONNECTION_ERROR)
+    g_propagate_error (error, tmperr);
+  else
+    {
+      g_error_free (tmperr);
+      g_input_stream_close (self->input_stream, NULL, NULL);
+      g_output_stream_close (self->output_stream, NULL, NULL);
+      close_io (self, error);
     }
 }
 
@@ -546,8 +1567,22 @@ WebMessage* web_connection_step (WebConnection* web_connection, GError** error)
   GError* tmperr = NULL;
   GIOStatus status = 0;
 
-  if ((status = process_out (& self->out, G_POLLABLE_OUTPUT_STREAM (self->output_stream), &tmperr)), G_UNLIKELY (tmperr != NULL))
-    g_propagate_error (error, tmperr);
+#ifdef HAVE_IO_URING
+  if (self->ring == NULL)
+    self->ring = web_ring_get_thread_default ();
+#endif // HAVE_IO_URING
+  if (self->wheel == NULL)
+    self->wheel = web_timer_wheel_get_thread_default ();
+
+  if (G_UNLIKELY (self->expired == TRUE))
+    {
+      g_input_stream_close (self->input_stream, NULL, NULL);
+      close_io (self, error);
+      return NULL;
+    }
+
+  if ((status = process_out (self, &tmperr)), G_UNLIKELY (tmperr != NULL))
+    fail_io (self, tmperr, error);
   else
     {
       switch (status)
@@ -560,35 +1595,37 @@ WebMessage* web_connection_step (WebConnection* web_connection, GError** error)
           g_output_stream_close (self->output_stream, NULL, NULL);
           G_GNUC_FALLTHROUGH;
         case G_IO_STATUS_ERROR:
-          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED, _("Connection closed"));
+          close_io (self, error);
           break;
 
         case G_IO_STATUS_NORMAL:
           {
-            if ((status = process_in (& self->in, G_POLLABLE_INPUT_STREAM (self->input_stream), &tmperr)), G_UNLIKELY (tmperr != NULL))
-              g_propagate_error (error, tmperr);
+            /* stop parsing pipelined requests until one of those
+             * in flight has been answered */
+            if (is_saturated (self) || self->in.failed == TRUE)
+              break;
+
+            if ((status = process_in (self, &tmperr)), G_UNLIKELY (tmperr != NULL))
+              fail_io (self, tmperr, error);
             else
               {
                 switch (status)
                   {
                     case G_IO_STATUS_AGAIN:
-                      {
-                        if ((g_get_monotonic_time () - self->in.uptime) < (keepalive_timeout_secs * G_USEC_PER_SEC))
-                          break;
-                        G_GNUC_FALLTHROUGH;
-                      }
+                      break;
 
                     case G_IO_STATUS_EOF:
                       g_input_stream_close (self->input_stream, NULL, NULL);
                       G_GNUC_FALLTHROUGH;
                     case G_IO_STATUS_ERROR:
-                      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED, _("Connection closed"));
+                      close_io (self, error);
                       break;
 
                     case G_IO_STATUS_NORMAL:
                       {
                         struct _InputIO* io = & self->in;
                         WebParserField* field = NULL;
+                        GList* list = NULL;
 
                         if (self->http_version == WEB_HTTP_VERSION_NONE)
                           self->http_version = io->parser.http_version;
@@ -596,15 +1633,14 @@ WebMessage* web_connection_step (WebConnection* web_connection, GError** error)
                           {
                             if (io->parser.http_version != self->http_version)
                               {
-                                web_parser_clear (& io->parser);
-                                web_parser_init (& io->parser);
+                                web_parser_reset (& io->parser);
 
                                 g_set_error_literal (error, WEB_CONNECTION_ERROR, WEB_CONNECTION_ERROR_MISMATCH_VERSION, _("Request versions mismatches"));
                                 break;
                               }
                           }
 
-                        web_message = web_message_new ();
+                        web_message = _web_message_acquire ();
 
                         web_message_set_http_version (web_message, io->parser.http_version);
                         web_message_set_is_closure (web_message, FALSE);
@@ -612,30 +1648,28 @@ WebMessage* web_connection_step (WebConnection* web_connection, GError** error)
                         web_message_set_uri (web_message, io->parser.uri);
 
                         if (self->http_version >= WEB_HTTP_VERSION_2_0)
-                          g_object_set_qdata (G_OBJECT (web_message), seqid_quark (), GUINT_TO_POINTER (0));
+                          _web_message_set_seqid (web_message, 0);
                         else
                           {
                             if (!g_uint_checked_add (& self->out.seqidn, 1, self->out.seqidn))
                               {
-                                web_parser_clear (& io->parser);
-                                web_parser_init (& io->parser);
+                                web_parser_reset (& io->parser);
 
                                 g_set_error_literal (error, WEB_CONNECTION_ERROR, WEB_CONNECTION_ERROR_REQUEST_OVERFLOW, _("Too much requests for connection"));
                                 break;
                               }
 
-                            g_object_set_qdata (G_OBJECT (web_message), seqid_quark (), GUINT_TO_POINTER (self->out.seqidn));
+                            _web_message_set_seqid (web_message, self->out.seqidn);
                           }
 
                         g_object_get (web_message, "request-headers", &web_message_headers, NULL);
 
-                        while ((field = g_queue_pop_head (& io->parser.fields)) != NULL)
+                        /* fields are copied from the parser's arena into the
+                         * message's one, the former is reset right after */
+                        for (list = io->parser.fields.head; list; list = list->next)
                           {
-                            gchar* name = g_steal_pointer (& field->name);
-                            gchar* value = g_steal_pointer (& field->value);
-
-                            web_message_headers_append_take (web_message_headers, name, value);
-                            web_parser_field_free (field);
+                            field = list->data;
+                            web_message_headers_append_field (web_message_headers, field->field_id, field->name, field->value, field->valuesz);
                           }
 
                         if (self->http_version < WEB_HTTP_VERSION_1_1)
@@ -644,12 +1678,13 @@ WebMessage* web_connection_step (WebConnection* web_connection, GError** error)
                           {
                             if (!web_message_headers_get_keep_alive (web_message_headers))
                               web_message_set_is_closure (web_message, TRUE);
+                            else if (self->out.seqidn >= self->limits.max_requests)
+                              web_message_set_is_closure (web_message, TRUE);
                           }
 
                         web_message_headers_unref (web_message_headers);
 
-                        web_parser_clear (& io->parser);
-                        web_parser_init (& io->parser);
+                        web_parser_reset (& io->parser);
                         break;
                       }
                   }
@@ -658,5 +1693,8 @@ WebMessage* web_connection_step (WebConnection* web_connection, GError** error)
           }
       }
     }
+
+  if (self->in.closed == FALSE)
+    schedule (self);
 return (web_message);
 }
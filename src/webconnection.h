@@ -23,7 +23,10 @@
 #define WEB_CONNECTION(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), WEB_TYPE_CONNECTION, WebConnection))
 #define WEB_IS_CONNECTION(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WEB_TYPE_CONNECTION))
 typedef struct _WebConnection WebConnection;
+typedef struct _WebConnectionLimits WebConnectionLimits;
 #define WEB_CONNECTION_ERROR (web_connection_error_quark ())
+typedef gboolean (*WebConnectionSourceFunc) (WebConnection* web_connection, gpointer user_data);
+#define WEB_CONNECTION_MAX_PIPELINED (64)
 
 #if __cplusplus
 extern "C" {
@@ -37,10 +40,24 @@ extern "C" {
     WEB_CONNECTION_ERROR_REQUEST_OVERFLOW,
   } WebConnectionError;
 
+  struct _WebConnectionLimits
+  {
+    guint keepalive_timeout;
+    guint max_header_bytes;
+    guint max_header_count;
+    guint max_header_length;
+    guint max_pipelined;
+    guint max_request_line;
+    guint max_requests;
+  };
+
   G_GNUC_INTERNAL GType web_connection_get_type (void) G_GNUC_CONST;
   G_GNUC_INTERNAL GQuark web_connection_error_quark (void) G_GNUC_CONST;
+  G_GNUC_INTERNAL GSource* web_connection_create_source (WebConnection* web_connection);
   G_GNUC_INTERNAL WebConnection* web_connection_new (GSocket* socket, gboolean is_https);
+  G_GNUC_INTERNAL guint web_connection_reserve (WebConnection* web_connection, GError** error);
   G_GNUC_INTERNAL void web_connection_send (WebConnection* web_connection, WebMessage* web_message);
+  G_GNUC_INTERNAL void web_connection_set_limits (WebConnection* web_connection, const WebConnectionLimits* limits);
   G_GNUC_INTERNAL WebMessage* web_connection_step (WebConnection* web_connection, GError** error);
 
 #if __cplusplus
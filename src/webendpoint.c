@@ -15,6 +15,7 @@
  * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <config.h>
+#include <errno.h>
 #include <glib/gi18n.h>
 #include <gio/gnetworking.h>
 #include <marshals.h>
@@ -32,7 +33,12 @@ struct _WebEndpoint
   GObject parent;
 
   /* private */
+  guint accepted;
+  GSource* backoff;
+  GMainContext* context;
+  guint dropped;
   guint is_https : 1;
+  GMutex lock;
   GSocket* socket;
   GSource* source;
 };
@@ -45,6 +51,9 @@ struct _WebEndpointClass
 enum
 {
   prop_0,
+  prop_accepted,
+  prop_context,
+  prop_dropped,
   prop_is_https,
   prop_socket,
   prop_number,
@@ -61,6 +70,79 @@ G_DEFINE_FINAL_TYPE (WebEndpoint, web_endpoint, G_TYPE_OBJECT);
 static GParamSpec* properties [prop_number] = {0};
 static guint signals [signal_number] = {0};
 
+static const guint accept_backoff_ms = 250;
+static const guint accept_batch = 64;
+static GSource* create_source (WebEndpoint* self);
+
+static GSocket* accept_one (GSocket* socket, GError** error)
+{
+#ifndef HAVE_ACCEPT4
+  return g_socket_accept (socket, NULL, error);
+#else // HAVE_ACCEPT4
+  const gint fd = g_socket_get_fd (socket);
+  const gint flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  gint client_fd;
+
+  do client_fd = accept4 (fd, NULL, NULL, flags);
+  while (G_UNLIKELY (client_fd < 0 && errno == EINTR));
+
+  if (G_UNLIKELY (client_fd < 0))
+    {
+      const int errsv = errno;
+      const GIOErrorEnum code = g_io_error_from_errno (errsv);
+
+      g_set_error (error, G_IO_ERROR, code, _("Error accepting connection: %s"), g_strerror (errsv));
+      return NULL;
+    }
+return g_socket_new_from_fd (client_fd, error);
+#endif // HAVE_ACCEPT4
+}
+
+static gboolean on_backoff (WebEndpoint* self)
+{
+  g_mutex_lock (& self->lock);
+
+  /* pause () and resume () destroy the backoff under the lock, so
+   * if it is still alive the accept loop was the one to stop */
+  if (g_source_is_destroyed (g_main_current_source ()) == FALSE)
+    {
+      g_source_unref (self->backoff);
+      self->backoff = NULL;
+
+      if (self->source == NULL)
+        self->source = create_source (self);
+    }
+
+  g_mutex_unlock (& self->lock);
+return G_SOURCE_REMOVE;
+}
+
+static void backoff (WebEndpoint* self)
+{
+  g_mutex_lock (& self->lock);
+
+  /* out of descriptors the connection stays in the listen queue
+   * and the socket readable, so polling it again right away would
+   * just spin; stop for a while and let connections close */
+  if (self->source != NULL && self->backoff == NULL)
+    {
+      g_source_destroy (self->source);
+      g_source_unref (self->source);
+      self->source = NULL;
+
+      self->backoff = g_timeout_source_new (accept_backoff_ms);
+      g_source_set_callback (self->backoff, (GSourceFunc) on_backoff, self, NULL);
+#if GLIB_CHECK_VERSION(2, 70, 0)
+      g_source_set_static_name (self->backoff, "[WebEndpoint.BackoffSource]");
+#else // GLIB_CHECK_VERSION(2, 70, 0)
+      g_source_set_name (self->backoff, "[WebEndpoint.BackoffSource]");
+#endif // GLIB_CHECK_VERSION(2, 70, 0)
+      g_source_attach (self->backoff, self->context);
+    }
+
+  g_mutex_unlock (& self->lock);
+}
+
 static gboolean accept_source (GSocket* socket, GIOCondition condition, WebEndpoint* self)
 {
   if (g_source_is_destroyed (g_main_current_source ()))
@@ -90,30 +172,53 @@ static gboolean accept_source (GSocket* socket, GIOCondition condition, WebEndpo
           GSocket* client_socket = NULL;
           gboolean handled = FALSE;
           GError* tmperr = NULL;
+          guint i;
 
-          if ((client_socket = g_socket_accept (socket, NULL, &tmperr)), G_UNLIKELY (tmperr != NULL))
+          /* drain the accept queue, but no more than accept_batch
+           * connections per wakeup so other sources get their turn */
+          for (i = 0; i < accept_batch; ++i)
             {
-              _g_object_unref0 (client_socket);
-              g_signal_emit (self, signals [signal_failed_connection], 0, tmperr);
-              g_error_free (tmperr);
+              if ((client_socket = accept_one (socket, &tmperr)), G_UNLIKELY (tmperr != NULL))
+                {
+                  /* EMFILE and ENFILE, the connection is not lost yet */
+                  if (g_error_matches (tmperr, G_IO_ERROR, G_IO_ERROR_TOO_MANY_OPEN_FILES))
+                    {
+                      g_signal_emit (self, signals [signal_failed_connection], 0, tmperr);
+                      backoff (self);
+                    }
+                  else if (!g_error_matches (tmperr, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+                    {
+                      g_atomic_int_inc (& self->dropped);
+                      g_signal_emit (self, signals [signal_failed_connection], 0, tmperr);
+                    }
+
+                  g_error_free (tmperr);
+                  break;
+                }
+
+              if ((g_signal_emit (self, signals [signal_new_connection], 0, client_socket, &handled)), handled)
+                g_atomic_int_inc (& self->accepted);
+              else
+                {
+                  g_atomic_int_inc (& self->dropped);
+                  g_socket_close (client_socket, NULL);
+                }
+
+              g_object_unref (client_socket);
+
+              /* a handler may have paused the endpoint */
+              if (g_source_is_destroyed (g_main_current_source ()))
+                break;
             }
-
-          if ((g_signal_emit (self, signals [signal_new_connection], 0, client_socket, &handled)), !handled)
-            g_socket_close (client_socket, NULL);
-            g_object_unref (client_socket);
         }
     }
 return G_SOURCE_CONTINUE;
 }
 
-static void web_endpoint_class_constructed (GObject* pself)
+static GSource* create_source (WebEndpoint* self)
 {
-  WebEndpoint* self = (gpointer) pself;
-G_OBJECT_CLASS (web_endpoint_parent_class)->constructed (pself);
-  GSocket* socket = self->socket;
-  GSource* source = g_socket_create_source (socket, G_IO_IN, NULL);
+  GSource* source = g_socket_create_source (self->socket, G_IO_IN, NULL);
   GSourceFunc func = (GSourceFunc) accept_source;
-  GMainContext* context = g_main_context_get_thread_default ();
 
   g_source_set_callback (source, func, self, NULL);
   g_source_set_priority (source, G_PRIORITY_DEFAULT);
@@ -122,7 +227,19 @@ G_OBJECT_CLASS (web_endpoint_parent_class)->constructed (pself);
 #else // GLIB_CHECK_VERSION(2, 70, 0)
   g_source_set_name (source, "[WebEndpoint.AcceptSource]");
 #endif // GLIB_CHECK_VERSION(2, 70, 0)
-  g_source_attach ((self->source = source), context);
+  g_source_attach (source, self->context);
+return source;
+}
+
+static void web_endpoint_class_constructed (GObject* pself)
+{
+  WebEndpoint* self = (gpointer) pself;
+G_OBJECT_CLASS (web_endpoint_parent_class)->constructed (pself);
+
+  if (self->context == NULL)
+    self->context = g_main_context_ref_thread_default ();
+
+  self->source = create_source (self);
 }
 
 static void web_endpoint_class_dispose (GObject* pself)
@@ -135,8 +252,21 @@ G_OBJECT_CLASS (web_endpoint_parent_class)->dispose (pself);
 static void web_endpoint_class_finalize (GObject* pself)
 {
   WebEndpoint* self = (gpointer) pself;
-  g_source_destroy (self->source);
-  g_source_unref (self->source);
+
+  if (self->backoff != NULL)
+    {
+      g_source_destroy (self->backoff);
+      g_source_unref (self->backoff);
+    }
+
+  if (self->source != NULL)
+    {
+      g_source_destroy (self->source);
+      g_source_unref (self->source);
+    }
+
+  g_main_context_unref (self->context);
+  g_mutex_clear (& self->lock);
 G_OBJECT_CLASS (web_endpoint_parent_class)->finalize (pself);
 }
 
@@ -146,6 +276,15 @@ static void web_endpoint_class_get_property (GObject* pself, guint property_id,
 
   switch (property_id)
     {
+      case prop_accepted:
+        g_value_set_uint (value, web_endpoint_get_accepted (self));
+        break;
+      case prop_context:
+        g_value_set_boxed (value, web_endpoint_get_context (self));
+        break;
+      case prop_dropped:
+        g_value_set_uint (value, web_endpoint_get_dropped (self));
+        break;
       case prop_is_https:
         g_value_set_boolean (value, web_endpoint_get_is_https (self));
         break;
@@ -165,6 +304,9 @@ static void web_endpoint_class_set_property (GObject* pself, guint property_id,
 
   switch (property_id)
     {
+      case prop_context:
+        self->context = g_value_dup_boxed (value);
+        break;
       case prop_is_https:
         self->is_https = g_value_get_boolean (value);
         break;
@@ -188,11 +330,15 @@ static void web_endpoint_class_init (WebEndpointClass* klass)
 
   const GType gtype = G_TYPE_FROM_CLASS (klass);
   const GParamFlags flags1 = G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS;
+  const GParamFlags flags3 = G_PARAM_READABLE | G_PARAM_STATIC_STRINGS;
   const GSignalFlags flags2 = G_SIGNAL_RUN_FIRST;
   const GSignalAccumulator accum1 = g_signal_accumulator_true_handled;
   const GSignalCMarshaller marshaller1 = web_cclosure_marshal_VOID__BOXED;
   const GSignalCMarshaller marshaller2 = web_cclosure_marshal_BOOLEAN__OBJECT;
 
+  properties [prop_accepted] = g_param_spec_uint ("accepted", "accepted", "accepted", 0, G_MAXUINT, 0, flags3);
+  properties [prop_context] = g_param_spec_boxed ("context", "context", "context", G_TYPE_MAIN_CONTEXT, flags1);
+  properties [prop_dropped] = g_param_spec_uint ("dropped", "dropped", "dropped", 0, G_MAXUINT, 0, flags3);
   properties [prop_is_https] = g_param_spec_boolean ("is-https", "is-https", "is-https", 0, flags1);
   properties [prop_socket] = g_param_spec_object ("socket", "socket", "socket", G_TYPE_SOCKET, flags1);
   g_object_class_install_properties (G_OBJECT_CLASS (klass), prop_number, properties);
@@ -202,9 +348,10 @@ static void web_endpoint_class_init (WebEndpointClass* klass)
 
 static void web_endpoint_init (WebEndpoint* self)
 {
+  g_mutex_init (& self->lock);
 }
 
-WebEndpoint* web_endpoint_new (GSocket* socket, gboolean is_https, GError** error)
+WebEndpoint* web_endpoint_new (GSocket* socket, gboolean is_https, GMainContext* context, GError** error)
 {
   g_return_val_if_fail (G_IS_SOCKET (socket), NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
@@ -222,7 +369,25 @@ WebEndpoint* web_endpoint_new (GSocket* socket, gboolean is_https, GError** erro
       g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, _("Can't import unconnected socket"));
       return NULL;
     }
-return g_object_new (WEB_TYPE_ENDPOINT, "socket", socket, "is-https", is_https, NULL);
+return g_object_new (WEB_TYPE_ENDPOINT, "context", context, "socket", socket, "is-https", is_https, NULL);
+}
+
+guint web_endpoint_get_accepted (WebEndpoint* web_endpoint)
+{
+  g_return_val_if_fail (WEB_IS_ENDPOINT (web_endpoint), 0);
+return (guint) g_atomic_int_get (& web_endpoint->accepted);
+}
+
+GMainContext* web_endpoint_get_context (WebEndpoint* web_endpoint)
+{
+  g_return_val_if_fail (WEB_IS_ENDPOINT (web_endpoint), NULL);
+return web_endpoint->context;
+}
+
+guint web_endpoint_get_dropped (WebEndpoint* web_endpoint)
+{
+  g_return_val_if_fail (WEB_IS_ENDPOINT (web_endpoint), 0);
+return (guint) g_atomic_int_get (& web_endpoint->dropped);
 }
 
 gboolean web_endpoint_get_is_https (WebEndpoint* web_endpoint)
@@ -236,3 +401,43 @@ GSocket* web_endpoint_get_socket (WebEndpoint* web_endpoint)
   g_return_val_if_fail (WEB_IS_ENDPOINT (web_endpoint), NULL);
 return web_endpoint->socket;
 }
+
+void web_endpoint_pause (WebEndpoint* web_endpoint)
+{
+  g_return_if_fail (WEB_IS_ENDPOINT (web_endpoint));
+  g_mutex_lock (& web_endpoint->lock);
+
+  if (web_endpoint->backoff != NULL)
+    {
+      g_source_destroy (web_endpoint->backoff);
+      g_source_unref (web_endpoint->backoff);
+      web_endpoint->backoff = NULL;
+    }
+
+  if (web_endpoint->source != NULL)
+    {
+      g_source_destroy (web_endpoint->source);
+      g_source_unref (web_endpoint->source);
+      web_endpoint->source = NULL;
+    }
+
+  g_mutex_unlock (& web_endpoint->lock);
+}
+
+void web_endpoint_resume (WebEndpoint* web_endpoint)
+{
+  g_return_if_fail (WEB_IS_ENDPOINT (web_endpoint));
+  g_mutex_lock (& web_endpoint->lock);
+
+  if (web_endpoint->backoff != NULL)
+    {
+      g_source_destroy (web_endpoint->backoff);
+      g_source_unref (web_endpoint->backoff);
+      web_endpoint->backoff = NULL;
+    }
+
+  if (web_endpoint->source == NULL)
+    web_endpoint->source = create_source (web_endpoint);
+
+  g_mutex_unlock (& web_endpoint->lock);
+}
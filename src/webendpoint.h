@@ -28,9 +28,14 @@ extern "C" {
 #endif // __cplusplus
 
   G_GNUC_INTERNAL GType web_endpoint_get_type (void) G_GNUC_CONST;
-  G_GNUC_INTERNAL WebEndpoint* web_endpoint_new (GSocket* socket, gboolean is_https, GError** error);
+  G_GNUC_INTERNAL WebEndpoint* web_endpoint_new (GSocket* socket, gboolean is_https, GMainContext* context, GError** error);
+  G_GNUC_INTERNAL guint web_endpoint_get_accepted (WebEndpoint* web_endpoint);
+  G_GNUC_INTERNAL GMainContext* web_endpoint_get_context (WebEndpoint* web_endpoint);
+  G_GNUC_INTERNAL guint web_endpoint_get_dropped (WebEndpoint* web_endpoint);
   G_GNUC_INTERNAL gboolean web_endpoint_get_is_https (WebEndpoint* web_endpoint);
   G_GNUC_INTERNAL GSocket* web_endpoint_get_socket (WebEndpoint* web_endpoint);
+  G_GNUC_INTERNAL void web_endpoint_pause (WebEndpoint* web_endpoint);
+  G_GNUC_INTERNAL void web_endpoint_resume (WebEndpoint* web_endpoint);
 
 #if __cplusplus
 }
@@ -65,8 +65,12 @@ WebHttpVersion web_http_version_from_bits (guint major, guint minor)
 
 const gchar* web_http_version_to_string (WebHttpVersion http_version)
 {
-  GEnumClass* klass = g_type_class_ref (WEB_TYPE_HTTP_VERSION);
-  GEnumValue* value = g_enum_get_value (klass, (gint) http_version);
-  const gchar* nick = g_intern_string (value->value_nick);
-return (g_type_class_unref (klass), nick);
+  switch (http_version)
+    {
+      case WEB_HTTP_VERSION_0_9: return "0.9";
+      case WEB_HTTP_VERSION_1_0: return "1.0";
+      case WEB_HTTP_VERSION_1_1: return "1.1";
+      case WEB_HTTP_VERSION_2_0: return "2.0";
+      default: return "none";
+    }
 }
@@ -24,5 +24,6 @@ G_DEFINE_FLAGS_TYPE
     G_DEFINE_ENUM_VALUE (WEB_LISTEN_OPTION_NONE, "none"),
     G_DEFINE_ENUM_VALUE (WEB_LISTEN_OPTION_IPV4_ONLY, "ipv4_only"),
     G_DEFINE_ENUM_VALUE (WEB_LISTEN_OPTION_IPV6_ONLY, "ipv6_only"),
-    G_DEFINE_ENUM_VALUE (WEB_LISTEN_OPTION_HTTPS, "https")
+    G_DEFINE_ENUM_VALUE (WEB_LISTEN_OPTION_HTTPS, "https"),
+    G_DEFINE_ENUM_VALUE (WEB_LISTEN_OPTION_REUSE_PORT, "reuse_port")
   );
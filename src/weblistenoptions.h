@@ -30,6 +30,7 @@ extern "C" {
     WEB_LISTEN_OPTION_IPV4_ONLY = (1 << 0),
     WEB_LISTEN_OPTION_IPV6_ONLY = (1 << 1),
     WEB_LISTEN_OPTION_HTTPS = (1 << 2),
+    WEB_LISTEN_OPTION_REUSE_PORT = (1 << 3),
   } WebListenOptions;
 
   G_GNUC_INTERNAL GType web_listen_options_get_type (void) G_GNUC_CONST;
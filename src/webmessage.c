@@ -17,15 +17,24 @@
 #include <config.h>
 #include <marshals.h>
 #include <webmessage.h>
+#include <webmessageheaderparse.h>
 
+G_GNUC_INTERNAL WebMessage* _web_message_acquire (void);
+G_GNUC_INTERNAL void _web_message_cache_drain (void);
 G_GNUC_INTERNAL guint _web_message_get_freeze_count (WebMessage* web_message);
+G_GNUC_INTERNAL guint _web_message_get_seqid (WebMessage* web_message);
+G_GNUC_INTERNAL void _web_message_release (WebMessage* web_message);
+G_GNUC_INTERNAL void _web_message_set_seqid (WebMessage* web_message, guint seqid);
+G_GNUC_INTERNAL WebMessageBody* _web_message_body_reset (WebMessageBody* web_message_body);
 #define _g_free0(var) ((var == NULL) ? NULL : (var = (g_free (var), NULL)))
 #define _g_object_unref0(var) ((var == NULL) ? NULL : (var = (g_object_unref (var), NULL)))
 #define _g_uri_unref0(var) ((var == NULL) ? NULL : (var = (g_uri_unref (var), NULL)))
+#define MESSAGE_CACHE_MAX (64)
 
 struct _WebMessagePrivate
 {
-  guint freeze_count : 7;
+  WebArena arena;
+  guint freeze_count;
   WebHttpVersion http_version;
   guint is_closure : 1;
   const gchar* method;
@@ -33,6 +42,7 @@ struct _WebMessagePrivate
   WebMessageHeaders* request_headers;
   WebMessageBody* response_body;
   WebMessageHeaders* response_headers;
+  guint seqid;
   WebStatusCode status_code;
   GUri* uri;
 };
@@ -62,6 +72,13 @@ G_DEFINE_TYPE_WITH_PRIVATE (WebMessage, web_message, G_TYPE_OBJECT);
 static GParamSpec* properties [prop_number] = {0};
 static guint signals [signal_number] = {0};
 
+static void cache_free (GQueue* cache)
+{
+  g_queue_free_full (cache, g_object_unref);
+}
+
+static GPrivate cache = G_PRIVATE_INIT ((GDestroyNotify) cache_free);
+
 static void web_message_class_dispose (GObject* pself)
 {
   WebMessage* self = (gpointer) pself;
@@ -77,6 +94,7 @@ static void web_message_class_finalize (GObject* pself)
   web_message_headers_unref (priv->response_headers);
   web_message_body_unref (priv->request_body);
   web_message_body_unref (priv->response_body);
+  web_arena_clear (& priv->arena);
   _g_uri_unref0 (priv->uri);
 G_OBJECT_CLASS (web_message_parent_class)->finalize (pself);
 }
@@ -174,21 +192,102 @@ static void web_message_class_init (WebMessageClass* klass)
 static void web_message_init (WebMessage* self)
 {
   self->priv = web_message_get_instance_private (self);
+  web_arena_init (& self->priv->arena);
   self->priv->freeze_count = 0;
   self->priv->http_version = WEB_HTTP_VERSION_NONE;
   self->priv->method = NULL;
   self->priv->request_body = web_message_body_new ();
-  self->priv->request_headers = web_message_headers_new ();
+  self->priv->request_headers = web_message_headers_new_with_arena (& self->priv->arena);
   self->priv->response_body = web_message_body_new ();
-  self->priv->response_headers = web_message_headers_new ();
+  self->priv->response_headers = web_message_headers_new_with_arena (& self->priv->arena);
+  self->priv->seqid = 0;
   self->priv->status_code = WEB_STATUS_CODE_NONE;
   self->priv->uri = NULL;
 }
 
+WebMessage* _web_message_acquire (void)
+{
+  GQueue* queue = NULL;
+
+  if ((queue = g_private_get (&cache)) == NULL || queue->length == 0)
+    return web_message_new ();
+return g_queue_pop_head (queue);
+}
+
+void _web_message_cache_drain (void)
+{
+  g_private_replace (&cache, NULL);
+}
+
 guint _web_message_get_freeze_count (WebMessage* web_message)
 {
   g_return_val_if_fail (WEB_IS_MESSAGE (web_message), 0);
-  return web_message->priv->freeze_count;
+  return g_atomic_int_get (& web_message->priv->freeze_count);
+}
+
+guint _web_message_get_seqid (WebMessage* web_message)
+{
+  g_return_val_if_fail (WEB_IS_MESSAGE (web_message), 0);
+  return web_message->priv->seqid;
+}
+
+static gboolean is_shared (WebMessage* web_message)
+{
+  WebMessagePrivate* priv = web_message->priv;
+
+  /* headers handed out through g_object_get () keep pointing into
+   * the message's arena, so they pin it just as the message itself */
+  if (g_atomic_int_get (& G_OBJECT (web_message)->ref_count) > 1 || g_atomic_int_get (& priv->freeze_count) > 0)
+    return TRUE;
+  else if (g_atomic_int_get (& priv->request_headers->ref_count) > 1)
+    return TRUE;
+  else
+    return g_atomic_int_get (& priv->response_headers->ref_count) > 1;
+}
+
+void _web_message_release (WebMessage* web_message)
+{
+  g_return_if_fail (WEB_IS_MESSAGE (web_message));
+  WebMessagePrivate* priv = web_message->priv;
+  GQueue* queue = NULL;
+
+  /* a message nobody else holds can not be reached anymore, so it is
+   * reset in place and kept for the next request on this thread;
+   * otherwise the other owners finalize it as usual */
+  if (is_shared (web_message))
+    g_object_unref (web_message);
+  else
+    {
+      if ((queue = g_private_get (&cache)) == NULL)
+        g_private_set (&cache, queue = g_queue_new ());
+
+      if (queue->length >= MESSAGE_CACHE_MAX)
+        g_object_unref (web_message);
+      else
+        {
+          web_message_headers_clear (priv->request_headers);
+          web_message_headers_clear (priv->response_headers);
+          priv->request_body = _web_message_body_reset (priv->request_body);
+          priv->response_body = _web_message_body_reset (priv->response_body);
+
+          web_arena_reset (& priv->arena);
+          _g_uri_unref0 (priv->uri);
+
+          priv->http_version = WEB_HTTP_VERSION_NONE;
+          priv->is_closure = FALSE;
+          priv->method = NULL;
+          priv->seqid = 0;
+          priv->status_code = WEB_STATUS_CODE_NONE;
+
+          g_queue_push_head (queue, web_message);
+        }
+    }
+}
+
+void _web_message_set_seqid (WebMessage* web_message, guint seqid)
+{
+  g_return_if_fail (WEB_IS_MESSAGE (web_message));
+  web_message->priv->seqid = seqid;
 }
 
 WebMessage* web_message_new ()
@@ -200,9 +299,18 @@ void web_message_freeze (WebMessage* web_message)
 {
   g_return_if_fail (WEB_IS_MESSAGE (web_message));
   WebMessagePrivate* priv = web_message->priv;
-  g_return_if_fail (priv->freeze_count < (127 - 1));
+  g_return_if_fail (g_atomic_int_get (& priv->freeze_count) < G_MAXINT);
 
-  g_signal_emit (web_message, signals [signal_frozen], 0, ++priv->freeze_count);
+  /* handlers freeze and thaw from their own threads while the
+   * connection looks at the count from its worker */
+  g_signal_emit (web_message, signals [signal_frozen], 0, g_atomic_int_add (& priv->freeze_count, 1) + 1);
+}
+
+WebArena* web_message_get_arena (WebMessage* web_message)
+{
+  g_return_val_if_fail (WEB_IS_MESSAGE (web_message), NULL);
+  WebMessagePrivate* priv = web_message->priv;
+return & priv->arena;
 }
 
 WebHttpVersion web_message_get_http_version (WebMessage* web_message)
@@ -338,6 +446,16 @@ void web_message_set_status_full (WebMessage* web_message, WebStatusCode status_
   web_message_set_response (web_message, "text/plain", reason, strlen (reason));
 }
 
+void web_message_set_unavailable (WebMessage* web_message, guint retry_after)
+{
+  g_return_if_fail (WEB_IS_MESSAGE (web_message));
+  WebStatusCode status_code = WEB_STATUS_CODE_SERVICE_UNAVAILABLE;
+  WebMessagePrivate* priv = web_message->priv;
+
+  web_message_set_status_full (web_message, status_code, web_status_code_get_inline (status_code));
+  web_message_headers_set_retry_after (priv->response_headers, retry_after);
+}
+
 void web_message_set_upgrade_required (WebMessage* web_message, WebHttpVersion version_required)
 {
   g_return_if_fail (WEB_IS_MESSAGE (web_message));
@@ -361,7 +479,7 @@ void web_message_thaw (WebMessage* web_message)
 {
   g_return_if_fail (WEB_IS_MESSAGE (web_message));
   WebMessagePrivate* priv = web_message->priv;
-  g_return_if_fail (priv->freeze_count > 0);
+  g_return_if_fail (g_atomic_int_get (& priv->freeze_count) > 0);
 
-  g_signal_emit (web_message, signals [signal_thawed], 0, --priv->freeze_count);
+  g_signal_emit (web_message, signals [signal_thawed], 0, g_atomic_int_add (& priv->freeze_count, -1) - 1);
 }
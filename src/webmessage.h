@@ -17,6 +17,7 @@
 #ifndef __WEB_MESSAGE__
 #define __WEB_MESSAGE__ 1
 #include <gio/gio.h>
+#include <webarena.h>
 #include <webhttpversion.h>
 #include <webstatuscode.h>
 
@@ -27,6 +28,7 @@
 #define WEB_IS_MESSAGE(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WEB_TYPE_MESSAGE))
 typedef struct _WebMessage WebMessage;
 typedef struct _WebMessageBody WebMessageBody;
+typedef struct _WebMessageChunk WebMessageChunk;
 typedef struct _WebMessageHeaders WebMessageHeaders;
 typedef struct _WebMessageHeadersIter WebMessageHeadersIter;
 typedef struct _WebMessagePrivate WebMessagePrivate;
@@ -57,9 +59,17 @@ extern "C" {
     goffset end_offset;
   };
 
+  struct _WebMessageChunk
+  {
+    GBytes* bytes;
+    goffset offset;
+    goffset length;
+  };
+
   struct _WebMessageHeadersIter
   {
-    GHashTableIter iter;
+    WebMessageHeaders* headers;
+    guint index;
   };
 
   typedef enum
@@ -83,18 +93,24 @@ extern "C" {
   G_GNUC_INTERNAL GType web_message_headers_get_type (void) G_GNUC_CONST;
   G_GNUC_INTERNAL void web_message_body_add_bytes (WebMessageBody* web_message_body, GBytes* bytes);
   G_GNUC_INTERNAL void web_message_body_add_data (WebMessageBody* web_message_body, gpointer data, gsize length, GDestroyNotify notify);
+  G_GNUC_INTERNAL void web_message_body_add_file (WebMessageBody* web_message_body, goffset offset, goffset length);
+  G_GNUC_INTERNAL GList* web_message_body_get_chunks (WebMessageBody* web_message_body);
+  G_GNUC_INTERNAL gint web_message_body_get_fd (WebMessageBody* web_message_body);
   G_GNUC_INTERNAL GInputStream* web_message_body_get_stream (WebMessageBody* web_message_body);
   G_GNUC_INTERNAL WebMessageBody* web_message_body_new ();
   G_GNUC_INTERNAL WebMessageBody* web_message_body_ref (WebMessageBody* web_message_body);
+  G_GNUC_INTERNAL void web_message_body_set_fd (WebMessageBody* web_message_body, gint fd);
   G_GNUC_INTERNAL void web_message_body_set_stream (WebMessageBody* web_message_body, GInputStream* stream);
   G_GNUC_INTERNAL void web_message_body_unref (WebMessageBody* web_message_body);
   G_GNUC_INTERNAL void web_message_freeze (WebMessage* web_message);
+  G_GNUC_INTERNAL WebArena* web_message_get_arena (WebMessage* web_message);
   G_GNUC_INTERNAL WebHttpVersion web_message_get_http_version (WebMessage* web_message);
   G_GNUC_INTERNAL gboolean web_message_get_is_closure (WebMessage* web_message);
   G_GNUC_INTERNAL const gchar* web_message_get_method (WebMessage* web_message);
   G_GNUC_INTERNAL WebStatusCode web_message_get_status (WebMessage* web_message);
   G_GNUC_INTERNAL GUri* web_message_get_uri (WebMessage* web_message);
   G_GNUC_INTERNAL void web_message_headers_append (WebMessageHeaders* web_message_headers, const gchar* key, const gchar* value);
+  G_GNUC_INTERNAL void web_message_headers_append_field (WebMessageHeaders* web_message_headers, gint field_id, const gchar* key, const gchar* value, gsize length);
   G_GNUC_INTERNAL void web_message_headers_append_take (WebMessageHeaders* web_message_headers, gchar* key, gchar* value);
   G_GNUC_INTERNAL void web_message_headers_clear (WebMessageHeaders* web_message_headers);
   G_GNUC_INTERNAL gboolean web_message_headers_contains (WebMessageHeaders* web_message_headers, const gchar* key);
@@ -109,9 +125,13 @@ extern "C" {
   G_GNUC_INTERNAL void web_message_headers_iter_init (WebMessageHeadersIter* iter, WebMessageHeaders* web_message_headers);
   G_GNUC_INTERNAL gboolean web_message_headers_iter_next (WebMessageHeadersIter* iter, gchar const** key, GList** values);
   G_GNUC_INTERNAL WebMessageHeaders* web_message_headers_new ();
+  G_GNUC_INTERNAL WebMessageHeaders* web_message_headers_new_with_arena (WebArena* arena);
   G_GNUC_INTERNAL WebMessageHeaders* web_message_headers_ref (WebMessageHeaders* web_message_headers);
   G_GNUC_INTERNAL void web_message_headers_remove (WebMessageHeaders* web_message_headers, const gchar* key);
+  G_GNUC_INTERNAL void web_message_headers_remove_field (WebMessageHeaders* web_message_headers, guint field_id);
   G_GNUC_INTERNAL void web_message_headers_replace (WebMessageHeaders* web_message_headers, const gchar* key, const gchar* value);
+  G_GNUC_INTERNAL void web_message_headers_replace_field (WebMessageHeaders* web_message_headers, guint field_id, const gchar* value, gsize length);
+  G_GNUC_INTERNAL void web_message_headers_replace_field_take (WebMessageHeaders* web_message_headers, guint field_id, gchar* value);
   G_GNUC_INTERNAL void web_message_headers_replace_take (WebMessageHeaders* web_message_headers, gchar* key, gchar* value);
   G_GNUC_INTERNAL void web_message_headers_set_content_disposition (WebMessageHeaders* web_message_headers, const gchar* disposition, ...) G_GNUC_NULL_TERMINATED;
   G_GNUC_INTERNAL void web_message_headers_set_content_disposition_va (WebMessageHeaders* web_message_headers, const gchar* disposition, va_list l);
@@ -119,6 +139,7 @@ extern "C" {
   G_GNUC_INTERNAL void web_message_headers_set_content_range (WebMessageHeaders* web_message_headers, goffset begin_offset, goffset end_offset, goffset length);
   G_GNUC_INTERNAL void web_message_headers_set_content_type (WebMessageHeaders* web_message_headers, const gchar* type);
   G_GNUC_INTERNAL void web_message_headers_set_location (WebMessageHeaders* web_message_headers, const gchar* uri);
+  G_GNUC_INTERNAL void web_message_headers_set_retry_after (WebMessageHeaders* web_message_headers, guint seconds);
   G_GNUC_INTERNAL void web_message_headers_unref (WebMessageHeaders* web_message_headers);
   G_GNUC_INTERNAL WebMessage* web_message_new ();
   G_GNUC_INTERNAL void web_message_set_http_version (WebMessage* web_message, WebHttpVersion http_version);
@@ -133,6 +154,7 @@ extern "C" {
   G_GNUC_INTERNAL void web_message_set_response_take (WebMessage* web_message, const gchar* content_type, gchar* response, gsize length);
   G_GNUC_INTERNAL void web_message_set_status (WebMessage* web_message, WebStatusCode status_code);
   G_GNUC_INTERNAL void web_message_set_status_full (WebMessage* web_message, WebStatusCode status_code, const gchar* reason);
+  G_GNUC_INTERNAL void web_message_set_unavailable (WebMessage* web_message, guint retry_after);
   G_GNUC_INTERNAL void web_message_set_upgrade_required (WebMessage* web_message, WebHttpVersion version_required);
   G_GNUC_INTERNAL void web_message_set_uri (WebMessage* web_message, GUri* uri);
   G_GNUC_INTERNAL void web_message_thaw (WebMessage* web_message);
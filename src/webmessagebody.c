@@ -15,29 +15,66 @@
  * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <config.h>
+#include <glib/gstdio.h>
 #include <webmessage.h>
 
+#define _g_bytes_unref0(var) ((var == NULL) ? NULL : (var = (g_bytes_unref (var), NULL)))
+#define _g_close0(var) ((var < 0) ? -1 : (var = (g_close (var, NULL), -1)))
 #define _g_free0(var) ((var == NULL) ? NULL : (var = (g_free (var), NULL)))
 #define _g_object_unref0(var) ((var == NULL) ? NULL : (var = (g_object_unref (var), NULL)))
+G_GNUC_INTERNAL WebMessageBody* _web_message_body_reset (WebMessageBody* web_message_body);
 
 struct _WebMessageBody
 {
   guint ref_count;
-
-  union /*<variant>*/
-  {
-    GInputStream* stream;
-    GMemoryInputStream* backend;
-  };
+  GQueue chunks;
+  gint fd;
+  GInputStream* stream;
 };
 
+static void chunk_free (WebMessageChunk* chunk)
+{
+  _g_bytes_unref0 (chunk->bytes);
+  g_slice_free (WebMessageChunk, chunk);
+}
+
+static void push_chunk (WebMessageBody* self, GBytes* bytes, goffset offset, goffset length)
+{
+  WebMessageChunk* chunk = g_slice_new (WebMessageChunk);
+
+  chunk->bytes = bytes;
+  chunk->offset = offset;
+  chunk->length = length;
+  g_queue_push_tail (& self->chunks, chunk);
+}
+
+WebMessageBody* _web_message_body_reset (WebMessageBody* web_message_body)
+{
+  g_return_val_if_fail (web_message_body != NULL, NULL);
+  WebMessageBody* self = (web_message_body);
+
+  /* a body still being sent belongs to the connection now */
+  if (g_atomic_int_get (&self->ref_count) > 1)
+    return (web_message_body_unref (self), web_message_body_new ());
+  else
+    {
+      g_queue_clear_full (& self->chunks, (GDestroyNotify) chunk_free);
+      _g_close0 (self->fd);
+      _g_object_unref0 (self->stream);
+    }
+return self;
+}
+
 WebMessageBody* web_message_body_new ()
 {
   WebMessageBody* self;
 
   self = g_slice_new (WebMessageBody);
   self->ref_count = 1;
-  self->backend = NULL;
+  self->fd = -1;
+  self->stream = NULL;
+
+  g_queue_init (& self->chunks);
 return self;
 }
 
@@ -55,6 +92,8 @@ void web_message_body_unref (WebMessageBody* web_message_body)
 
   if (g_atomic_int_dec_and_test (&self->ref_count))
     {
+      g_queue_clear_full (& self->chunks, (GDestroyNotify) chunk_free);
+      _g_close0 (self->fd);
       _g_object_unref0 (self->stream);
       g_slice_free (WebMessageBody, self);
     }
@@ -67,14 +106,13 @@ void web_message_body_add_bytes (WebMessageBody* web_message_body, GBytes* bytes
   g_return_if_fail (web_message_body != NULL);
   g_return_if_fail (bytes != NULL);
   WebMessageBody* self = (web_message_body);
+  gsize length = g_bytes_get_size (bytes);
 
-  if (G_IS_MEMORY_INPUT_STREAM (self->stream))
-    g_memory_input_stream_add_bytes (self->backend, bytes);
-  else
-    {
-      g_set_object (&self->stream, g_memory_input_stream_new_from_bytes (bytes));
-      g_object_unref (self->stream);
-    }
+  /* in-memory chunks replace a previously set stream */
+  _g_object_unref0 (self->stream);
+
+  if (length > 0)
+    push_chunk (self, g_bytes_ref (bytes), 0, length);
 }
 
 void web_message_body_add_data (WebMessageBody* web_message_body, gpointer data, gsize length, GDestroyNotify notify)
@@ -82,14 +120,45 @@ void web_message_body_add_data (WebMessageBody* web_message_body, gpointer data,
   g_return_if_fail (web_message_body != NULL);
   g_return_if_fail (length == 0 || data != NULL);
   WebMessageBody* self = (web_message_body);
+  GBytes* bytes = NULL;
 
-  if (G_IS_MEMORY_INPUT_STREAM (self->stream))
-    g_memory_input_stream_add_data (self->backend, data, length, notify);
-  else
-    {
-      g_set_object (&self->stream, g_memory_input_stream_new_from_data (data, length, notify));
-      g_object_unref (self->stream);
-    }
+  bytes = g_bytes_new_with_free_func (data, length, notify, data);
+  web_message_body_add_bytes (self, bytes);
+  g_bytes_unref (bytes);
+}
+
+void web_message_body_add_file (WebMessageBody* web_message_body, goffset offset, goffset length)
+{
+  g_return_if_fail (web_message_body != NULL);
+  g_return_if_fail (web_message_body->fd >= 0);
+  g_return_if_fail (offset >= 0 && length >= 0);
+  WebMessageBody* self = (web_message_body);
+
+  _g_object_unref0 (self->stream);
+
+  if (length > 0)
+    push_chunk (self, NULL, offset, length);
+}
+
+GList* web_message_body_get_chunks (WebMessageBody* web_message_body)
+{
+  g_return_val_if_fail (web_message_body != NULL, NULL);
+return web_message_body->chunks.head;
+}
+
+gint web_message_body_get_fd (WebMessageBody* web_message_body)
+{
+  g_return_val_if_fail (web_message_body != NULL, -1);
+return web_message_body->fd;
+}
+
+void web_message_body_set_fd (WebMessageBody* web_message_body, gint fd)
+{
+  g_return_if_fail (web_message_body != NULL);
+  WebMessageBody* self = (web_message_body);
+
+  _g_close0 (self->fd);
+  self->fd = fd;
 }
 
 void web_message_body_set_stream (WebMessageBody* web_message_body, GInputStream* stream)
@@ -97,6 +166,8 @@ void web_message_body_set_stream (WebMessageBody* web_message_body, GInputStream
   g_return_if_fail (web_message_body != NULL);
   g_return_if_fail (G_IS_INPUT_STREAM (stream));
   g_return_if_fail (G_IS_POLLABLE_INPUT_STREAM (stream));
+
+  g_queue_clear_full (& web_message_body->chunks, (GDestroyNotify) chunk_free);
   g_set_object (& web_message_body->stream, stream);
 }
 
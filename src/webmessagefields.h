@@ -16,10 +16,12 @@
  */
 #ifndef __WEB_MESSAGE_FIELDS__
 #define __WEB_MESSAGE_FIELDS__ 1
+#include <glib.h>
 
 #define WEB_MESSAGE_FIELD_ACCEPT ("accept")
 #define WEB_MESSAGE_FIELD_ACCEPT_ENCODING ("accept-encoding")
 #define WEB_MESSAGE_FIELD_ACCEPT_LANGUAGE ("accept-language")
+#define WEB_MESSAGE_FIELD_ACCEPT_RANGES ("accept-ranges")
 #define WEB_MESSAGE_FIELD_CONNECTION ("connection")
 #define WEB_MESSAGE_FIELD_CONTENT_DISPOSITION ("content-disposition")
 #define WEB_MESSAGE_FIELD_CONTENT_ENCODING ("content-encoding")
@@ -27,11 +29,56 @@
 #define WEB_MESSAGE_FIELD_CONTENT_RANGE ("content-range")
 #define WEB_MESSAGE_FIELD_CONTENT_TYPE ("content-type")
 #define WEB_MESSAGE_FIELD_DATE ("date")
+#define WEB_MESSAGE_FIELD_ETAG ("etag")
 #define WEB_MESSAGE_FIELD_HOST ("host")
+#define WEB_MESSAGE_FIELD_IF_MODIFIED_SINCE ("if-modified-since")
+#define WEB_MESSAGE_FIELD_IF_NONE_MATCH ("if-none-match")
+#define WEB_MESSAGE_FIELD_IF_RANGE ("if-range")
 #define WEB_MESSAGE_FIELD_KEEP_ALIVE ("keep-alive")
+#define WEB_MESSAGE_FIELD_LAST_MODIFIED ("last-modified")
 #define WEB_MESSAGE_FIELD_LOCATION ("location")
 #define WEB_MESSAGE_FIELD_RANGE ("range")
+#define WEB_MESSAGE_FIELD_RETRY_AFTER ("retry-after")
 #define WEB_MESSAGE_FIELD_SERVER ("server")
 #define WEB_MESSAGE_FIELD_USER_AGENT ("user-agent")
 
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  typedef enum
+  {
+    WEB_MESSAGE_FIELD_ID_ACCEPT,
+    WEB_MESSAGE_FIELD_ID_ACCEPT_ENCODING,
+    WEB_MESSAGE_FIELD_ID_ACCEPT_LANGUAGE,
+    WEB_MESSAGE_FIELD_ID_ACCEPT_RANGES,
+    WEB_MESSAGE_FIELD_ID_CONNECTION,
+    WEB_MESSAGE_FIELD_ID_CONTENT_DISPOSITION,
+    WEB_MESSAGE_FIELD_ID_CONTENT_ENCODING,
+    WEB_MESSAGE_FIELD_ID_CONTENT_LENGTH,
+    WEB_MESSAGE_FIELD_ID_CONTENT_RANGE,
+    WEB_MESSAGE_FIELD_ID_CONTENT_TYPE,
+    WEB_MESSAGE_FIELD_ID_DATE,
+    WEB_MESSAGE_FIELD_ID_ETAG,
+    WEB_MESSAGE_FIELD_ID_HOST,
+    WEB_MESSAGE_FIELD_ID_IF_MODIFIED_SINCE,
+    WEB_MESSAGE_FIELD_ID_IF_NONE_MATCH,
+    WEB_MESSAGE_FIELD_ID_IF_RANGE,
+    WEB_MESSAGE_FIELD_ID_KEEP_ALIVE,
+    WEB_MESSAGE_FIELD_ID_LAST_MODIFIED,
+    WEB_MESSAGE_FIELD_ID_LOCATION,
+    WEB_MESSAGE_FIELD_ID_RANGE,
+    WEB_MESSAGE_FIELD_ID_RETRY_AFTER,
+    WEB_MESSAGE_FIELD_ID_SERVER,
+    WEB_MESSAGE_FIELD_ID_USER_AGENT,
+    WEB_MESSAGE_FIELD_ID_COUNT,
+  } WebMessageFieldId;
+
+  G_GNUC_INTERNAL gint web_message_field_lookup (const gchar* name, gsize length) G_GNUC_PURE;
+  G_GNUC_INTERNAL const gchar* web_message_field_name (WebMessageFieldId field_id) G_GNUC_CONST;
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
 #endif // __WEB_MESSAGE_FIELDS__
@@ -16,6 +16,7 @@
  */
 #include <config.h>
 #include <glib/gi18n.h>
+#include <string.h>
 #include <webmessagefields.h>
 #include <webmessageheaderparse.h>
 
@@ -38,8 +39,7 @@
     return GSIZE_TO_POINTER (__value__); \
     }
 
-_DEFINE_PATTERN (split, "([^,]+?)")
-_DEFINE_PATTERN (range_split, "([a-z]+)=([0-9,\\-]+)")
+_DEFINE_PATTERN (range_split, "([a-z]+)=([0-9,\\- ]+)")
 _DEFINE_PATTERN (range_split2, "([0-9]*)\\-([0-9]*)")
 #undef _DEFINE_PATTERN
 
@@ -64,6 +64,7 @@ static void pushranges (WebMessageHeaders* self, const gchar* value, guint lengt
   GError* tmperr = NULL;
   GMatchInfo* info = NULL;
   WebMessageRange* range = NULL;
+  GList* link = NULL;
   gint start_start, start_stop;
   gint stop_start, stop_stop;
   goffset start, stop;
@@ -94,11 +95,16 @@ static void pushranges (WebMessageHeaders* self, const gchar* value, guint lengt
               break;
             }
 
-          range = g_slice_new (WebMessageRange);
+          range = web_arena_alloc (self->arena, sizeof (WebMessageRange));
           range->begin_offset = start;
           range->end_offset = stop;
 
-          g_queue_push_tail (& self->ranges, range);
+          link = web_arena_alloc (self->arena, sizeof (GList));
+          link->data = range;
+          link->next = NULL;
+          link->prev = NULL;
+
+          g_queue_push_tail_link (& self->ranges, link);
 
           if ((g_match_info_next (info, &tmperr)), G_UNLIKELY (tmperr != NULL))
             {
@@ -153,82 +159,108 @@ static void parseranges (WebMessageHeaders* self, const gchar* value, guint leng
   _g_match_info_free0 (info);
 }
 
-static guint append_values (GQueue* list, gchar* value)
+static gchar* strdown (WebArena* arena, const gchar* str, gsize length)
 {
-  GQueue tmp = G_QUEUE_INIT;
-  GList* link = NULL;
-  guint added = 0;
-  gsize length = strlen (value);
-  gsize i, l;
+  gchar* copy = web_arena_strndup (arena, str, length);
+  gsize i;
 
-  g_queue_push_tail (& tmp, value);
+  for (i = 0; i < length; ++i)
+    copy [i] = g_ascii_tolower (copy [i]);
+return copy;
+}
 
-  for (i = 0, l = 0; i < length; ++i)
-  if (value [i] == ',')
-    {
-      value [i] = 0;
+static void push_entry (WebMessageHeaders* self, gint field_id, const gchar* name, gchar* value)
+{
+  WebMessageHeaderEntry* entry = NULL;
+  gint first;
 
-      if (i < length && (i - l > 0))
+  if (self->n_entries == self->n_allocated)
+    {
+      /* the inline entries cover ordinary messages, bigger
+       * ones spill into a heap vector that keeps doubling */
+      if (self->entries != self->inline_entries)
+        self->entries = g_renew (WebMessageHeaderEntry, self->entries, self->n_allocated <<= 1);
+      else
         {
-          g_queue_push_tail (& tmp, (l = i, & value [i + 1]));
+          self->entries = g_new (WebMessageHeaderEntry, self->n_allocated <<= 1);
+          memcpy (self->entries, self->inline_entries, sizeof (self->inline_entries));
         }
     }
 
-  while ((link = g_queue_pop_head_link (& tmp)) != NULL)
+  if ((first = _web_message_headers_find (self, field_id, name)) >= 0)
+    self->entries [first].list = NULL;
+
+  entry = & self->entries [self->n_entries];
+  entry->field_id = field_id;
+  entry->is_first = first < 0;
+  entry->list = NULL;
+  entry->name = name;
+  entry->value = value;
+
+  if (first < 0 && field_id >= 0)
+    self->first [field_id] = self->n_entries + 1;
+
+  self->n_entries++;
+}
+
+gint _web_message_headers_find (WebMessageHeaders* self, gint field_id, const gchar* name)
+{
+  guint i;
+
+  if (field_id >= 0)
+    return ((gint) self->first [field_id]) - 1;
+  else
     {
-      if (G_STRUCT_MEMBER (gchar, link->data, 0) == 0)
-        g_list_free (link);
-      else
+      for (i = 0; i < self->n_entries; ++i)
+      if (self->entries [i].field_id < 0 && self->entries [i].name != NULL && self->entries [i].is_first)
         {
-          ++added;
-          link->data = g_strstrip (link->data);
-
-          g_queue_push_tail_link (list, link);
+          if (g_ascii_strcasecmp (self->entries [i].name, name) == 0)
+            return i;
         }
     }
-return (g_queue_clear (& tmp), added);
+return -1;
 }
 
-void _web_message_headers_parse_header (WebMessageHeaders* self, gchar* key, gchar* value)
+void _web_message_headers_push (WebMessageHeaders* self, gint field_id, const gchar* key, const gchar* value, gsize length)
 {
-  if (!g_strcmp0 (key, WEB_MESSAGE_FIELD_RANGE))
+  const gchar* name = NULL;
+  gint first;
+
+  if (field_id == WEB_MESSAGE_FIELD_ID_RANGE)
     {
       GError* tmperr = NULL;
 
-      if ((parseranges (self, value, strlen (value), &tmperr)), G_UNLIKELY (tmperr != NULL))
+      if ((parseranges (self, value, length, &tmperr)), G_UNLIKELY (tmperr != NULL))
         {
-          g_queue_clear_full (& self->ranges, (GDestroyNotify) _web_message_range_free);
+          /* nodes live in the arena, dropping them is enough */
+          g_queue_init (& self->ranges);
           g_error_free (tmperr);
         }
     }
   else
     {
-      GQueue* list;
-
-      if ((list = g_hash_table_lookup (self->fields, key)) != NULL)
-        {
-          if (append_values (list, value) == 0)
-            g_free (value);
-          else
-            {
-              g_queue_push_tail (& self->taken, value);
-            }
-          g_free (key);
-        }
+      if (field_id >= 0)
+        name = web_message_field_name (field_id);
+      else if ((first = _web_message_headers_find (self, field_id, key)) >= 0)
+        name = self->entries [first].name;
       else
-        {
-          list = g_queue_new ();
+        name = strdown (self->arena, key, strlen (key));
 
-          if (append_values (list, value) == 0)
-            {
-              g_queue_free (list);
-              g_free (value);
-            }
-          else
-            {
-              g_queue_push_tail (& self->taken, value);
-              g_hash_table_insert (self->fields, key, list);
-            }
-        }
+      /* values are kept as received, empty ones included (the parser
+       * accepts "Name:" on its own); web_message_headers_get_list ()
+       * splits comma lists the first time somebody asks for one */
+      push_entry (self, field_id, name, web_arena_strndup (self->arena, value, length));
     }
 }
+
+void _web_message_headers_parse_field (WebMessageHeaders* self, gint field_id, gchar* key, gchar* value)
+{
+  _web_message_headers_push (self, field_id, key, value, strlen (value));
+  g_free (key);
+  g_free (value);
+}
+
+void _web_message_headers_parse_header (WebMessageHeaders* self, gchar* key, gchar* value)
+{
+  _web_message_headers_parse_field (self, web_message_field_lookup (key, strlen (key)), key, value);
+}
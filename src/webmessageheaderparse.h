@@ -16,21 +16,39 @@
  */
 #ifndef __WEB_MESSAGE_HEADER_PARSE__
 #define __WEB_MESSAGE_HEADER_PARSE__ 1
+#include <webarena.h>
 #include <webmessage.h>
+#include <webmessagefields.h>
 
+typedef struct _WebMessageHeaderEntry WebMessageHeaderEntry;
 typedef struct _WebMessageHeaders WebMessageHeaders;
+#define WEB_MESSAGE_HEADERS_INLINE (16)
 #define WEB_MESSAGE_HEADER_PARSE_ERROR (web_message_header_parse_error_quark ())
 
 #if __cplusplus
 extern "C" {
 #endif // __cplusplus
 
+  struct _WebMessageHeaderEntry
+  {
+    gint field_id;
+    guint is_first : 1;
+    GList* list;
+    const gchar* name;
+    gchar* value;
+  };
+
   struct _WebMessageHeaders
   {
     guint ref_count;
-    GHashTable* fields;
+    WebArena* arena;
+    WebMessageHeaderEntry* entries;
+    guint first [WEB_MESSAGE_FIELD_ID_COUNT];
+    guint n_allocated;
+    guint n_entries;
+    WebArena own_arena;
     GQueue ranges;
-    GQueue taken;
+    WebMessageHeaderEntry inline_entries [WEB_MESSAGE_HEADERS_INLINE];
   };
 
   typedef enum
@@ -41,8 +59,10 @@ extern "C" {
   } WebMessageHeaderParseError;
 
   G_GNUC_INTERNAL GQuark web_message_header_parse_error_quark (void) G_GNUC_CONST;
+  G_GNUC_INTERNAL gint _web_message_headers_find (WebMessageHeaders* headers, gint field_id, const gchar* name);
+  G_GNUC_INTERNAL void _web_message_headers_parse_field (WebMessageHeaders* headers, gint field_id, gchar* key, gchar* value);
   G_GNUC_INTERNAL void _web_message_headers_parse_header (WebMessageHeaders* headers, gchar* key, gchar* value);
-  G_GNUC_INTERNAL void _web_message_range_free (WebMessageRange* range);
+  G_GNUC_INTERNAL void _web_message_headers_push (WebMessageHeaders* headers, gint field_id, const gchar* key, const gchar* value, gsize length);
 
 #if __cplusplus
 }
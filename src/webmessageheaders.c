@@ -15,22 +15,160 @@
  * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <config.h>
+#include <string.h>
 #include <webmessage.h>
 #include <webmessagefields.h>
 #include <webmessageheaderparse.h>
 #include <webmessagemethods.h>
 
+static gint lookup (WebMessageHeaders* self, const gchar* key)
+{
+  return _web_message_headers_find (self, web_message_field_lookup (key, strlen (key)), key);
+}
+
+static GList* append (WebMessageHeaders* self, GList* last, gpointer data)
+{
+  GList* link = web_arena_alloc (self->arena, sizeof (GList));
+
+  link->data = data;
+  link->next = NULL;
+  link->prev = last;
+
+  if (last != NULL)
+    last->next = link;
+return link;
+}
+
+static GList* collect (WebMessageHeaders* self, guint first)
+{
+  GList *head = NULL, *last = NULL;
+  guint i;
+
+  /* one node per stored line, values are handed out as received */
+  for (i = first; i < self->n_entries; ++i)
+  if (self->entries [i].name == self->entries [first].name)
+    {
+      last = append (self, last, self->entries [i].value);
+      head = head != NULL ? head : last;
+    }
+return head;
+}
+
+static GList* collect_split (WebMessageHeaders* self, guint first)
+{
+  WebMessageHeaderEntry* entry = & self->entries [first];
+  const gchar *element, *next;
+  GList* last = NULL;
+  gsize length;
+  guint i;
+
+  /* comma lists are split on first demand only, elements are copied
+   * into the arena so the raw values stay intact for serialization,
+   * and the list is cached on the first entry of the field */
+  if (entry->list == NULL)
+    {
+      for (i = first; i < self->n_entries; ++i)
+      if (self->entries [i].name == entry->name)
+        {
+          for (element = self->entries [i].value; element != NULL; element = next)
+            {
+              if ((next = strchr (element, ',')) != NULL)
+                length = (next++) - element;
+              else
+                length = strlen (element);
+
+              for (; length > 0 && g_ascii_isspace (element [0]); --length)
+                ++element;
+              for (; length > 0 && g_ascii_isspace (element [length - 1]); --length);
+
+              if (length > 0)
+                {
+                  last = append (self, last, web_arena_strndup (self->arena, element, length));
+                  entry->list = entry->list != NULL ? entry->list : last;
+                }
+            }
+        }
+    }
+return entry->list;
+}
+
+static gboolean has_token (const gchar* value, const gchar* token, gsize length)
+{
+  const gchar *element, *next;
+  gsize size;
+
+  for (element = value; element != NULL; element = next)
+    {
+      if ((next = strchr (element, ',')) != NULL)
+        size = (next++) - element;
+      else
+        size = strlen (element);
+
+      for (; size > 0 && g_ascii_isspace (element [0]); --size)
+        ++element;
+      for (; size > 0 && g_ascii_isspace (element [size - 1]); --size);
+
+      if (size == length && g_ascii_strncasecmp (element, token, length) == 0)
+        return TRUE;
+    }
+return FALSE;
+}
+
+static void remove_at (WebMessageHeaders* self, guint first)
+{
+  const gchar* name = self->entries [first].name;
+  const gint field_id = self->entries [first].field_id;
+  guint i;
+
+  /* entries are only marked dead, so indices never move */
+  for (i = first; i < self->n_entries; ++i)
+  if (self->entries [i].name == name)
+    {
+      self->entries [i].is_first = FALSE;
+      self->entries [i].list = NULL;
+      self->entries [i].name = NULL;
+      self->entries [i].value = NULL;
+    }
+
+  if (field_id >= 0)
+    self->first [field_id] = 0;
+}
+
+static void replace_field (WebMessageHeaders* self, guint field_id, const gchar* value, gsize length)
+{
+  gint first;
+
+  if ((first = _web_message_headers_find (self, field_id, NULL)) >= 0)
+    remove_at (self, first);
+
+  _web_message_headers_push (self, field_id, NULL, value, length);
+}
+
 WebMessageHeaders* web_message_headers_new ()
 {
   WebMessageHeaders* self;
-  const GHashFunc func1 = (GHashFunc) g_str_hash;
-  const GEqualFunc func2 = (GEqualFunc) g_str_equal;
-  const GDestroyNotify func3 = (GDestroyNotify) g_queue_free;
 
+  self = web_message_headers_new_with_arena (NULL);
+  self->arena = & self->own_arena;
+return self;
+}
+
+WebMessageHeaders* web_message_headers_new_with_arena (WebArena* arena)
+{
+  WebMessageHeaders* self;
+
+  /* a borrowed arena belongs to whoever passed it in (a message,
+   * usually), who must keep it alive while these headers are used */
   self = g_slice_new (WebMessageHeaders);
+  self->arena = arena;
   self->ref_count = 1;
-  self->fields = g_hash_table_new_full (func1, func2, g_free, func3);
-return (g_queue_init (& self->taken), self);
+  self->entries = self->inline_entries;
+  self->n_allocated = WEB_MESSAGE_HEADERS_INLINE;
+  self->n_entries = 0;
+
+  memset (self->first, 0, sizeof (self->first));
+  web_arena_init (& self->own_arena);
+return (g_queue_init (& self->ranges), self);
 }
 
 WebMessageHeaders* web_message_headers_ref (WebMessageHeaders* web_message_headers)
@@ -47,28 +185,34 @@ void web_message_headers_unref (WebMessageHeaders* web_message_headers)
 
   if (g_atomic_int_dec_and_test (&self->ref_count))
     {
-      g_hash_table_remove_all (self->fields);
-      g_hash_table_unref (self->fields);
-      g_queue_clear_full (& self->ranges, (GDestroyNotify) _web_message_range_free);
-      g_queue_clear_full (& self->taken, (GDestroyNotify) g_free);
+      if (self->entries != self->inline_entries)
+        g_free (self->entries);
+
+      web_arena_clear (& self->own_arena);
       g_slice_free (WebMessageHeaders, self);
     }
 }
 
 G_DEFINE_BOXED_TYPE (WebMessageHeaders, web_message_headers, web_message_headers_ref, web_message_headers_unref);
 
-void _web_message_range_free (WebMessageRange* range)
+void web_message_headers_append (WebMessageHeaders* web_message_headers, const gchar* key, const gchar* value)
 {
-  g_slice_free (WebMessageRange, range);
+  g_return_if_fail (web_message_headers != NULL);
+  g_return_if_fail (key != NULL && value != NULL);
+  WebMessageHeaders* self = (web_message_headers);
+
+  _web_message_headers_push (self, web_message_field_lookup (key, strlen (key)), key, value, strlen (value));
 }
 
-void web_message_headers_append (WebMessageHeaders* web_message_headers, const gchar* key, const gchar* value)
+void web_message_headers_append_field (WebMessageHeaders* web_message_headers, gint field_id, const gchar* key, const gchar* value, gsize length)
 {
   g_return_if_fail (web_message_headers != NULL);
-  g_return_if_fail (key != NULL && value != NULL);
+  g_return_if_fail (field_id < (gint) WEB_MESSAGE_FIELD_ID_COUNT);
+  g_return_if_fail (field_id >= 0 || key != NULL);
+  g_return_if_fail (value != NULL);
   WebMessageHeaders* self = (web_message_headers);
 
-  web_message_headers_append_take (self, g_strdup (key), g_strdup (value));
+  _web_message_headers_push (self, field_id, key, value, length);
 }
 
 void web_message_headers_append_take (WebMessageHeaders* web_message_headers, gchar* key, gchar* value)
@@ -85,7 +229,12 @@ void web_message_headers_clear (WebMessageHeaders* web_message_headers)
   g_return_if_fail (web_message_headers != NULL);
   WebMessageHeaders* self = (web_message_headers);
 
-  g_hash_table_remove_all (self->fields);
+  self->n_entries = 0;
+  memset (self->first, 0, sizeof (self->first));
+  g_queue_init (& self->ranges);
+
+  if (self->arena == & self->own_arena)
+    web_arena_reset (self->arena);
 }
 
 gboolean web_message_headers_contains (WebMessageHeaders* web_message_headers, const gchar* key)
@@ -93,7 +242,7 @@ gboolean web_message_headers_contains (WebMessageHeaders* web_message_headers, c
   g_return_val_if_fail (web_message_headers != NULL, FALSE);
   g_return_val_if_fail (key != NULL, FALSE);
   WebMessageHeaders* self = (web_message_headers);
-return g_hash_table_contains (self->fields, key);
+return lookup (self, key) >= 0;
 }
 
 goffset web_message_headers_get_content_length (WebMessageHeaders* web_message_headers)
@@ -129,14 +278,21 @@ gboolean web_message_headers_get_keep_alive (WebMessageHeaders* web_message_head
   g_return_val_if_fail (web_message_headers != NULL, 0);
   WebMessageHeaders* self = (web_message_headers);
 
-  if (!web_message_headers_contains (self, WEB_MESSAGE_FIELD_CONNECTION))
-    return FALSE;
-  else
+  const gchar* name = NULL;
+  guint first, i;
+
+  if ((first = self->first [WEB_MESSAGE_FIELD_ID_CONNECTION]) > 0)
     {
-      const gchar* a = "keep-alive";
-      const gchar* b = web_message_headers_get_one (self, WEB_MESSAGE_FIELD_CONNECTION);
-      return !g_ascii_strcasecmp (a, b);
+      name = self->entries [first - 1].name;
+
+      for (i = first - 1; i < self->n_entries; ++i)
+      if (self->entries [i].name == name)
+        {
+          if (has_token (self->entries [i].value, "keep-alive", sizeof ("keep-alive") - 1))
+            return TRUE;
+        }
     }
+return FALSE;
 }
 
 GList* web_message_headers_get_list (WebMessageHeaders* web_message_headers, const gchar* key)
@@ -144,8 +300,8 @@ GList* web_message_headers_get_list (WebMessageHeaders* web_message_headers, con
   g_return_val_if_fail (web_message_headers != NULL, NULL);
   g_return_val_if_fail (key != NULL, NULL);
   WebMessageHeaders* self = (web_message_headers);
-  GQueue* queue = g_hash_table_lookup (self->fields, key);
-return (queue == NULL) ? NULL : (g_queue_peek_head_link (queue));
+  gint first = lookup (self, key);
+return (first < 0) ? NULL : collect_split (self, first);
 }
 
 const gchar* web_message_headers_get_one (WebMessageHeaders* web_message_headers, const gchar* key)
@@ -153,8 +309,8 @@ const gchar* web_message_headers_get_one (WebMessageHeaders* web_message_headers
   g_return_val_if_fail (web_message_headers != NULL, NULL);
   g_return_val_if_fail (key != NULL, NULL);
   WebMessageHeaders* self = (web_message_headers);
-  GQueue* queue = g_hash_table_lookup (self->fields, key);
-return (queue == NULL) ? NULL : (g_queue_peek_head (queue));
+  gint first = lookup (self, key);
+return (first < 0) ? NULL : self->entries [first].value;
 }
 
 GList* web_message_headers_get_ranges (WebMessageHeaders* web_message_headers)
@@ -170,23 +326,28 @@ void web_message_headers_iter_init (WebMessageHeadersIter* iter, WebMessageHeade
   g_return_if_fail (web_message_headers != NULL);
   WebMessageHeaders* self = (web_message_headers);
 
-  g_hash_table_iter_init (& iter->iter, self->fields);
+  iter->headers = self;
+  iter->index = 0;
 }
 
 gboolean web_message_headers_iter_next (WebMessageHeadersIter* iter, gchar const** key, GList** values)
 {
   g_return_val_if_fail (iter != NULL, FALSE);
-  gboolean have = FALSE;
-  GQueue* list = NULL;
+  WebMessageHeaders* self = iter->headers;
+  guint i;
 
-  if ((have = g_hash_table_iter_next (& iter->iter, (gpointer*) key, (gpointer*) &list)) == TRUE)
+  while ((i = iter->index++) < self->n_entries)
     {
-      if (values != NULL)
+      if (self->entries [i].is_first)
         {
-          *values = list->head;
+          if (key != NULL)
+            *key = self->entries [i].name;
+          if (values != NULL)
+            *values = collect (self, i);
+          return TRUE;
         }
     }
-return (have);
+return FALSE;
 }
 
 void web_message_headers_remove (WebMessageHeaders* web_message_headers, const gchar* key)
@@ -194,8 +355,21 @@ void web_message_headers_remove (WebMessageHeaders* web_message_headers, const g
   g_return_if_fail (web_message_headers != NULL);
   g_return_if_fail (key != NULL);
   WebMessageHeaders* self = (web_message_headers);
+  gint first;
+
+  if ((first = lookup (self, key)) >= 0)
+    remove_at (self, first);
+}
+
+void web_message_headers_remove_field (WebMessageHeaders* web_message_headers, guint field_id)
+{
+  g_return_if_fail (web_message_headers != NULL);
+  g_return_if_fail (field_id < WEB_MESSAGE_FIELD_ID_COUNT);
+  WebMessageHeaders* self = (web_message_headers);
+  gint first;
 
-  g_hash_table_remove (self->fields, key);
+  if ((first = _web_message_headers_find (self, field_id, NULL)) >= 0)
+    remove_at (self, first);
 }
 
 void web_message_headers_replace (WebMessageHeaders* web_message_headers, const gchar* key, const gchar* value)
@@ -204,7 +378,8 @@ void web_message_headers_replace (WebMessageHeaders* web_message_headers, const
   g_return_if_fail (key != NULL && value != NULL);
   WebMessageHeaders* self = (web_message_headers);
 
-  web_message_headers_replace_take (self, g_strdup (key), g_strdup (value));
+  web_message_headers_remove (self, key);
+  web_message_headers_append (self, key, value);
 }
 
 void web_message_headers_replace_take (WebMessageHeaders* web_message_headers, gchar* key, gchar* value)
@@ -217,6 +392,27 @@ void web_message_headers_replace_take (WebMessageHeaders* web_message_headers, g
   web_message_headers_append_take (self, key, value);
 }
 
+void web_message_headers_replace_field (WebMessageHeaders* web_message_headers, guint field_id, const gchar* value, gsize length)
+{
+  g_return_if_fail (web_message_headers != NULL);
+  g_return_if_fail (field_id < WEB_MESSAGE_FIELD_ID_COUNT);
+  g_return_if_fail (value != NULL);
+  WebMessageHeaders* self = (web_message_headers);
+
+  replace_field (self, field_id, value, length);
+}
+
+void web_message_headers_replace_field_take (WebMessageHeaders* web_message_headers, guint field_id, gchar* value)
+{
+  g_return_if_fail (web_message_headers != NULL);
+  g_return_if_fail (field_id < WEB_MESSAGE_FIELD_ID_COUNT);
+  g_return_if_fail (value != NULL);
+  WebMessageHeaders* self = (web_message_headers);
+
+  replace_field (self, field_id, value, strlen (value));
+  g_free (value);
+}
+
 void web_message_headers_set_content_disposition (WebMessageHeaders* web_message_headers, const gchar* disposition, ...)
 {
   g_return_if_fail (web_message_headers != NULL);
@@ -234,14 +430,11 @@ void web_message_headers_set_content_disposition_va (WebMessageHeaders* web_mess
   g_return_if_fail (web_message_headers != NULL);
   g_return_if_fail (disposition != NULL);
   WebMessageHeaders* self = (web_message_headers);
-  GQueue* list = NULL;
-  const gchar *key_ = WEB_MESSAGE_FIELD_CONTENT_DISPOSITION;
   const gchar *key, *value;
+  gsize keysz, valuesz;
   gchar* value_ = NULL;
 
-  web_message_headers_replace (self, key_, disposition);
-  list = g_hash_table_lookup (self->fields, key_);
-  g_assert (list != NULL);
+  replace_field (self, WEB_MESSAGE_FIELD_ID_CONTENT_DISPOSITION, disposition, strlen (disposition));
 
   while (TRUE)
     {
@@ -250,10 +443,15 @@ void web_message_headers_set_content_disposition_va (WebMessageHeaders* web_mess
       else
         {
           value = va_arg (l, gchar*);
-          value_ = g_strdup_printf ("%s=%s", key, value);
+          keysz = strlen (key);
+          valuesz = strlen (value);
+          value_ = web_arena_alloc (self->arena, keysz + valuesz + 1);
+
+          memcpy (value_, key, keysz);
+          memcpy (value_ + keysz + 1, value, valuesz);
+          value_ [keysz] = '=';
 
-          g_queue_push_tail (list, value_);
-          g_queue_push_tail (& self->taken, value_);
+          _web_message_headers_push (self, WEB_MESSAGE_FIELD_ID_CONTENT_DISPOSITION, NULL, value_, keysz + valuesz + 1);
         }
     }
 }
@@ -262,18 +460,27 @@ void web_message_headers_set_content_length (WebMessageHeaders* web_message_head
 {
   g_return_if_fail (web_message_headers != NULL);
   WebMessageHeaders* self = (web_message_headers);
+  gchar buffer [32];
+  gint wrote;
 
-  web_message_headers_replace_take (self, g_strdup (WEB_MESSAGE_FIELD_CONTENT_LENGTH), g_strdup_printf ("%" G_GINT64_MODIFIER "u", length));
+  wrote = g_snprintf (buffer, sizeof (buffer), "%" G_GSIZE_FORMAT, length);
+  replace_field (self, WEB_MESSAGE_FIELD_ID_CONTENT_LENGTH, buffer, wrote);
 }
 
 void web_message_headers_set_content_range (WebMessageHeaders* web_message_headers, goffset begin_offset, goffset end_offset, goffset length)
 {
   g_return_if_fail (web_message_headers != NULL);
   WebMessageHeaders* self = (web_message_headers);
+  gchar buffer [96];
+  gint wrote;
 
-  web_message_headers_replace_take (self, g_strdup (WEB_MESSAGE_FIELD_CONTENT_RANGE),
-    g_strdup_printf ("%" G_GINT64_MODIFIER "u-%" G_GINT64_MODIFIER "u/%" G_GINT64_MODIFIER "u",
-      begin_offset, end_offset, length));
+  /* a negative begin offset produces the unsatisfied-range form used with 416 */
+  if (begin_offset < 0)
+    wrote = g_snprintf (buffer, sizeof (buffer), "bytes */%" G_GINT64_FORMAT, length);
+  else
+    wrote = g_snprintf (buffer, sizeof (buffer), "bytes %" G_GINT64_FORMAT "-%" G_GINT64_FORMAT "/%" G_GINT64_FORMAT, begin_offset, end_offset, length);
+
+  replace_field (self, WEB_MESSAGE_FIELD_ID_CONTENT_RANGE, buffer, wrote);
 }
 
 void web_message_headers_set_content_type (WebMessageHeaders* web_message_headers, const gchar* type)
@@ -281,7 +488,7 @@ void web_message_headers_set_content_type (WebMessageHeaders* web_message_header
   g_return_if_fail (web_message_headers != NULL);
   WebMessageHeaders* self = (web_message_headers);
 
-  web_message_headers_replace_take (self, g_strdup (WEB_MESSAGE_FIELD_CONTENT_TYPE), g_strdup (type));
+  replace_field (self, WEB_MESSAGE_FIELD_ID_CONTENT_TYPE, type, strlen (type));
 }
 
 void web_message_headers_set_location (WebMessageHeaders* web_message_headers, const gchar* uri)
@@ -289,5 +496,16 @@ void web_message_headers_set_location (WebMessageHeaders* web_message_headers, c
   g_return_if_fail (web_message_headers != NULL);
   WebMessageHeaders* self = (web_message_headers);
 
-  web_message_headers_replace_take (self, g_strdup (WEB_MESSAGE_FIELD_LOCATION), g_strdup (uri));
+  replace_field (self, WEB_MESSAGE_FIELD_ID_LOCATION, uri, strlen (uri));
+}
+
+void web_message_headers_set_retry_after (WebMessageHeaders* web_message_headers, guint seconds)
+{
+  g_return_if_fail (web_message_headers != NULL);
+  WebMessageHeaders* self = (web_message_headers);
+  gchar buffer [16];
+  gint length;
+
+  length = g_snprintf (buffer, sizeof (buffer), "%u", seconds);
+  replace_field (self, WEB_MESSAGE_FIELD_ID_RETRY_AFTER, buffer, length);
 }
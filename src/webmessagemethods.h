@@ -16,9 +16,20 @@
  */
 #ifndef __WEB_MESSAGE_METHODS__
 #define __WEB_MESSAGE_METHODS__ 1
+#include <glib.h>
 
 #define WEB_MESSAGE_METHOD_GET ("get")
 #define WEB_MESSAGE_METHOD_HEAD ("head")
 #define WEB_MESSAGE_METHOD_POST ("post")
 
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  G_GNUC_INTERNAL const gchar* web_message_method_lookup (const gchar* name, gsize length) G_GNUC_PURE;
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
 #endif // __WEB_MESSAGE_METHODS__
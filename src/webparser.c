@@ -15,36 +15,26 @@
  * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <config.h>
+#include <string.h>
 #include <webhttpversion.h>
 #include <webmessagefields.h>
 #include <webmessagemethods.h>
 #include <webparser.h>
 
-typedef struct _Patterns Patterns;
 #define _g_free0(var) ((var == NULL) ? NULL : (var = (g_free (var), NULL)))
-#define _g_match_info_free0(var) ((var == NULL) ? NULL : (var = (g_match_info_free (var), NULL)))
 #define _g_uri_unref0(var) ((var == NULL) ? NULL : (var = (g_uri_unref (var), NULL)))
-#define _web_parser_patterns_unref0(var) ((var == NULL) ? NULL : (var = (web_parser_patterns_unref (var), NULL)))
-#define web_parser_field_new() (g_slice_new0 (WebParserField))
-
-#define PATTERNS_INIT Patterns* patterns = patterns_peek ()
+#define web_parser_field_new(parser) (memset (web_arena_alloc (& (parser)->arena, sizeof (WebParserField)), 0, sizeof (WebParserField)))
+#define is_ws(c) ((c) == ' ' || (c) == '\t')
 
+static GUri* base_uri_peek ();
 static void parse_header_line (WebParser* self, const gchar* line, gsize length, GError** error);
 static guint parse_http_version_bit (const gchar* line, gsize length, gsize offset, GError** error);
 static const gchar* parse_method (const gchar* line, gsize length, gsize offset, GError** error);
 static void parse_request_line (WebParser* self, const gchar* line, gsize length, GError** error);
-static void parse_request_line_full (WebParser* self, GMatchInfo* info, const gchar* line, gsize length, GError** error);
-static void parse_request_line_simple (WebParser* self, GMatchInfo* info, const gchar* line, gsize length, GError** error);
-
-struct _Patterns
-{
-  guint ref_count;
-  GUri* base_uri;
-  GRegex* folded_field;
-  GRegex* full_request_line;
-  GRegex* simple_field;
-  GRegex* simple_request_line;
-};
+static void parse_request_target (WebParser* self, const gchar* line, gsize length, gsize offset, GError** error);
+static void parse_request_version (WebParser* self, const gchar* line, gsize length, gsize offset, GError** error);
+static gsize scan_token (const gchar* line, gsize length, gsize offset);
+static gboolean scan_version (const gchar* line, gsize length, gsize offset, gsize* dot);
 
 G_DEFINE_QUARK (web-parser-error-quark, web_parser_error);
 
@@ -70,58 +60,15 @@ static GUri* _web_uri_parse (const gchar* uri_string, GUriFlags uri_flags)
 #endif // DEVELOPER
 }
 
-static GRegex* _web_regex_new (const gchar* pattern, GRegexCompileFlags compile_flags, GRegexMatchFlags match_flags)
-{
-#if DEVELOPER == 1
-  GError* tmperr = NULL;
-  GRegex* regex = NULL;
-
-  if ((regex = g_regex_new (pattern, compile_flags, match_flags, &tmperr)), G_UNLIKELY (tmperr == NULL))
-      return regex;
-    else
-      {
-        const gchar* domain = g_quark_to_string (tmperr->domain);
-        const gchar* message = tmperr->message;
-        const guint code = tmperr->code;
-
-        g_error ("(" G_STRLOC "): %s: %d: %s", domain, code, message);
-        g_assert_not_reached ();
-      }
-#else // DEVELOPER
-  return g_regex_new (pattern, compile_flags, match_flags, NULL);
-#endif // DEVELOPER
-}
-
-static Patterns* patterns_peek ()
+static GUri* base_uri_peek ()
 {
   static gsize __value__ = 0;
 
   if (g_once_init_enter (&__value__))
     {
-      Patterns* self;
-
-      /* components */
-      #define CTL "\\x{0}-\\x{1f}"
-      #define HEX "[:xdigit:]"
-      #define CR "\\x{0d}"
-      #define LF "\\x{0a}"
-      #define CRLF CR LF
-      #define SP "\\x{20}"
-      #define HT "\\x{09}"
-      #define SPECIALS "\\(\\)<>@,;:\\\\\"/\\[\\]\\?={}\\x{0a}\\x{0d}"
-
-      /* entities */
-      #define TEXT "[^" CTL "\\x{0a}\\x{0d}]"
-      #define TOKEN "[^" CTL SPECIALS "]"
-
-      self = g_slice_new (Patterns);
-      self->base_uri = _web_uri_parse ("http://localhost/", G_URI_FLAGS_NON_DNS);
-      self->folded_field = _web_regex_new ("^[" SP HT "](.+)$", G_REGEX_OPTIMIZE | G_REGEX_RAW, 0);
-      self->full_request_line = _web_regex_new ("^(" TOKEN "+)\\s(.+?)\\sHTTP/([0-9]+)\\.([0-9]+)$", G_REGEX_OPTIMIZE | G_REGEX_RAW, 0);
-      self->simple_field = _web_regex_new ("^(" TOKEN "+):\\s(.+)$", G_REGEX_OPTIMIZE | G_REGEX_RAW, 0);
-      self->simple_request_line = _web_regex_new ("^(" TOKEN "+)\\s(.+)$", G_REGEX_OPTIMIZE | G_REGEX_RAW, 0);
-
-      g_once_init_leave (& __value__, GPOINTER_TO_SIZE (self));
+      GUri* uri = _web_uri_parse ("http://localhost/", G_URI_FLAGS_NON_DNS);
+
+      g_once_init_leave (& __value__, GPOINTER_TO_SIZE (uri));
       G_STATIC_ASSERT (sizeof (__value__) == GLIB_SIZEOF_VOID_P);
     }
 return GSIZE_TO_POINTER (__value__);
@@ -129,65 +76,57 @@ return GSIZE_TO_POINTER (__value__);
 
 static void parse_header_line (WebParser* self, const gchar* line, gsize length, GError** error)
 {
-  gboolean matches;
-  GMatchInfo* info;
-  GError* tmperr = NULL;
   WebParserField* field;
+  GList* link;
+  gsize name_end;
+  gsize value_start, value_end;
 
-  PATTERNS_INIT;
+  /* trailing whitespace never belongs to a value */
+  for (value_end = length; value_end > 0 && is_ws (line [value_end - 1]); --value_end);
 
-  gint name_start, name_end;
-  gint value_start, value_end;
-
-  if ((matches = g_regex_match_full (patterns->simple_field, line, length, 0, 0, &info, &tmperr)), G_UNLIKELY (tmperr != NULL))
+  if (is_ws (line [0]))
     {
-      g_propagate_error (error, tmperr);
-      _g_match_info_free0 (info);
-    }
-  else if (matches == TRUE)
-    {
-      g_match_info_fetch_pos (info, 1, &name_start, &name_end);
-      g_match_info_fetch_pos (info, 2, &value_start, &value_end);
-      _g_match_info_free0 (info);
+      if (g_queue_get_length (& self->fields) == 0)
+        g_set_error (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_MALFORMED_FIELD, "Misplaced folded field");
+      else
+        {
+          for (value_start = 1; value_start < value_end && is_ws (line [value_start]); ++value_start);
 
-      field = web_parser_field_new ();
+          if (value_start < value_end)
+            {
+              field = g_queue_peek_tail (& self->fields);
+              const gchar* chunk = & G_STRUCT_MEMBER (gchar, line, value_start);
+              const gsize chunksz = value_end - value_start;
 
-      web_parser_field_set_name (field, & G_STRUCT_MEMBER (gchar, line, name_start), name_end - name_start);
-      web_parser_field_add_value (field, & G_STRUCT_MEMBER (gchar, line, value_start), value_end - value_start);
-      g_queue_push_tail (& self->fields, g_steal_pointer (&field));
+              if (field->valuesz + chunksz + 2 > self->max_header_length)
+                g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_HEADERS_TOO_LARGE, "Header field too long");
+              else
+                web_parser_field_add_value (self, g_steal_pointer (&field), chunk, chunksz);
+            }
+        }
     }
   else
     {
-      _g_match_info_free0 (info);
-
-      if ((matches = g_regex_match_full (patterns->folded_field, line, length, 0, 0, &info, &tmperr)), G_UNLIKELY (tmperr != NULL))
-        {
-          g_propagate_error (error, tmperr);
-          _g_match_info_free0 (info);
-        }
-      else if (matches == FALSE)
-        {
-          g_set_error (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_MALFORMED_FIELD, "Malformed field");
-          _g_match_info_free0 (info);
-        }
+      if ((name_end = scan_token (line, length, 0)) == 0 || name_end == length || line [name_end] != ':')
+        g_set_error (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_MALFORMED_FIELD, "Malformed field");
+      else if (g_queue_get_length (& self->fields) >= self->max_header_count)
+        g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_HEADERS_TOO_LARGE, "Too many header fields");
       else
         {
-          if (g_queue_get_length (& self->fields) == 0)
-            {
-              g_set_error (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_MALFORMED_FIELD, "Misplaced folded field");
-              _g_match_info_free0 (info);
-            }
-          else
-            {
-              g_match_info_fetch_pos (info, 1, &value_start, &value_end);
-              _g_match_info_free0 (info);
+          for (value_start = name_end + 1; value_start < value_end && is_ws (line [value_start]); ++value_start);
 
-              field = g_queue_peek_tail (& self->fields);
-              const gchar* chunk = & G_STRUCT_MEMBER (gchar, line, value_start);
-              const gsize chunksz = value_end - value_start;
+          field = web_parser_field_new (self);
+          link = web_arena_alloc (& self->arena, sizeof (GList));
 
-              web_parser_field_add_value (g_steal_pointer (&field), chunk, chunksz);
-            }
+          web_parser_field_set_name (self, field, line, name_end);
+          web_parser_field_add_value (self, field, & G_STRUCT_MEMBER (gchar, line, value_start), value_end - value_start);
+
+          /* list nodes come from the arena as well, so the queue
+           * is never cleared through g_queue_clear () */
+          link->data = g_steal_pointer (&field);
+          link->next = NULL;
+          link->prev = NULL;
+          g_queue_push_tail_link (& self->fields, link);
         }
     }
 }
@@ -216,85 +155,90 @@ static guint parse_http_version_bit (const gchar* line, gsize length, gsize offs
 return (_g_free0 (dynbuf), (guint) n);
 }
 
-G_STATIC_ASSERT (sizeof (WEB_MESSAGE_METHOD_HEAD) == 5);
-
 static const gchar* parse_method (const gchar* line, gsize length, gsize offset, GError** error)
 {
-  if ((length - offset) == (sizeof (WEB_MESSAGE_METHOD_GET) - 1) && g_ascii_strncasecmp (WEB_MESSAGE_METHOD_GET, line + offset, length - offset) == 0)
-    return WEB_MESSAGE_METHOD_GET;
-  else if ((length - offset) == (sizeof (WEB_MESSAGE_METHOD_HEAD) - 1) && g_ascii_strncasecmp (WEB_MESSAGE_METHOD_HEAD, line + offset, length - offset) == 0)
-    return WEB_MESSAGE_METHOD_HEAD;
-  else if ((length - offset) == (sizeof (WEB_MESSAGE_METHOD_POST) - 1) && g_ascii_strncasecmp (WEB_MESSAGE_METHOD_POST, line + offset, length - offset) == 0)
-    return WEB_MESSAGE_METHOD_POST;
-  else
-    {
-      const gchar* method = & G_STRUCT_MEMBER (gchar, line, offset);
-      const gsize size = length - offset;
+  const gchar* method = & G_STRUCT_MEMBER (gchar, line, offset);
+  const gsize size = length - offset;
+  const gchar* known = NULL;
 
-      g_set_error (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_UNKNOWN_METHOD, "Unknown method '%.*s'", (int) size, method);
-    }
-return (NULL);
+  if ((known = web_message_method_lookup (method, size)) == NULL)
+    g_set_error (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_UNKNOWN_METHOD, "Unknown method '%.*s'", (int) size, method);
+return (known);
 }
 
 static void parse_request_line (WebParser* self, const gchar* line, gsize length, GError** error)
 {
-  gboolean matches;
-  GMatchInfo* info;
   GError* tmperr = NULL;
+  const gchar* method = NULL;
+  gsize method_end;
+  gsize target_start, target_end;
+  gsize version_start, dot;
 
-  PATTERNS_INIT;
-
-  if ((matches = g_regex_match_full (patterns->full_request_line, line, length, 0, 0, &info, &tmperr)), G_UNLIKELY (tmperr != NULL))
+  if ((method_end = scan_token (line, length, 0)) == 0 || method_end + 1 >= length || !is_ws (line [method_end]))
     {
-      g_propagate_error (error, tmperr);
-      _g_match_info_free0 (info);
+      g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_MALFORMED_REQUEST, "Invalid request line");
+      return;
     }
-  else if (matches == TRUE)
+
+  target_start = method_end + 1;
+
+  /* the protocol version, if any, follows the last whitespace;
+   * without one this is an HTTP/0.9 simple request */
+  for (version_start = length; version_start > target_start && !is_ws (line [version_start - 1]); --version_start);
+
+  if (version_start > target_start + 1 && scan_version (line, length, version_start, &dot))
+    target_end = version_start - 1;
+  else
     {
-      parse_request_line_full (self, info, line, length, error);
-      _g_match_info_free0 (info);
+      self->got_simple_request = TRUE;
+      self->http_version = WEB_HTTP_VERSION_0_9;
+      target_end = length;
+      version_start = 0;
     }
+
+  if ((method = parse_method (line, method_end, 0, &tmperr)), G_UNLIKELY (tmperr != NULL))
+    g_propagate_error (error, tmperr);
+  else if ((parse_request_target (self, line, target_end, target_start, &tmperr)), G_UNLIKELY (tmperr != NULL))
+    g_propagate_error (error, tmperr);
   else
     {
-      _g_match_info_free0 (info);
+      self->method = method;
 
-      if ((matches = g_regex_match_full (patterns->simple_request_line, line, length, 0, 0, &info, &tmperr)), G_UNLIKELY (tmperr != NULL))
-        {
-          g_propagate_error (error, tmperr);
-          _g_match_info_free0 (info);
-        }
-      else if (matches == TRUE)
-        {
-          self->got_simple_request = TRUE;
-          self->http_version = WEB_HTTP_VERSION_0_9;
+      if (version_start > 0)
+        parse_request_version (self, line, length, version_start, error);
+    }
+}
 
-          parse_request_line_simple (self, info, line, length, error);
-          _g_match_info_free0 (info);
-        }
-      else
-        {
-          g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_MALFORMED_REQUEST, "Invalid request line");
-          _g_match_info_free0 (info);
-        }
+static void parse_request_target (WebParser* self, const gchar* line, gsize length, gsize offset, GError** error)
+{
+  gchar* path = NULL;
+  GError* tmperr = NULL;
+  GUri* uri = NULL;
+
+  path = g_utf8_make_valid (& G_STRUCT_MEMBER (gchar, line, offset), length - offset);
+  uri = g_uri_parse_relative (base_uri_peek (), path, G_URI_FLAGS_NON_DNS, &tmperr);
+
+  if ((g_free (path)), G_UNLIKELY (tmperr != NULL))
+    g_propagate_error (error, tmperr);
+  else
+    {
+      _g_uri_unref0 (self->uri);
+      self->uri = uri;
     }
 }
 
-static void parse_request_line_full (WebParser* self, GMatchInfo* info, const gchar* line, gsize length, GError** error)
+static void parse_request_version (WebParser* self, const gchar* line, gsize length, gsize offset, GError** error)
 {
   GError* tmperr = NULL;
   WebHttpVersion version = 0;
-  gint major_start, major_end;
-  gint minor_start, minor_end;
   guint major, minor;
+  gsize dot;
 
-  g_match_info_fetch_pos (info, 3, &major_start, &major_end);
-  g_match_info_fetch_pos (info, 4, &minor_start, &minor_end);
+  scan_version (line, length, offset, &dot);
 
-  if ((parse_request_line_simple (self, info, line, length, &tmperr)), G_UNLIKELY (tmperr != NULL))
-    g_propagate_error (error, tmperr);
-  else if ((major = parse_http_version_bit (line, major_end, major_start, &tmperr)), G_UNLIKELY (tmperr != NULL))
+  if ((major = parse_http_version_bit (line, dot, offset + 5, &tmperr)), G_UNLIKELY (tmperr != NULL))
     g_propagate_error (error, tmperr);
-  else if ((minor = parse_http_version_bit (line, minor_end, minor_start, &tmperr)), G_UNLIKELY (tmperr != NULL))
+  else if ((minor = parse_http_version_bit (line, length, dot + 1, &tmperr)), G_UNLIKELY (tmperr != NULL))
     g_propagate_error (error, tmperr);
   else if ((version = web_http_version_from_bits (major, minor)) == WEB_HTTP_VERSION_NONE)
     g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_UNSUPPORTED_VERSION, "Unsupported HTTP version");
@@ -302,42 +246,64 @@ static void parse_request_line_full (WebParser* self, GMatchInfo* info, const gc
     self->http_version = version;
 }
 
-static void parse_request_line_simple (WebParser* self, GMatchInfo* info, const gchar* line, gsize length, GError** error)
+static gsize scan_token (const gchar* line, gsize length, gsize offset)
 {
-  gchar* path = NULL;
-  GError* tmperr = NULL;
-  GUri* uri = NULL;
+  gsize i;
 
-  PATTERNS_INIT;
+  for (i = offset; i < length; ++i)
+    {
+      switch (line [i])
+        {
+          case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+          case '+': case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+            continue;
+          default:
+            if (g_ascii_isalnum (line [i]))
+              continue;
+            break;
+        }
+      break;
+    }
+return i;
+}
 
-  const gchar* method;
-  gint method_start, method_end;
-  gint path_start, path_end;
+static gboolean scan_version (const gchar* line, gsize length, gsize offset, gsize* dot)
+{
+  gsize i;
 
-  g_match_info_fetch_pos (info, 1, &method_start, &method_end);
-  g_match_info_fetch_pos (info, 2, &path_start, &path_end);
+  /* HTTP/<digits>.<digits> up to the end of line */
+  if (length - offset < 8 || memcmp (line + offset, "HTTP/", 5) != 0)
+    return FALSE;
 
-  if ((method = parse_method (line, method_end, method_start, &tmperr)), G_UNLIKELY (tmperr != NULL))
-    g_propagate_error (error, tmperr);
+  for (i = offset + 5; i < length && g_ascii_isdigit (line [i]); ++i);
+
+  if (i == offset + 5 || i == length || line [i] != '.')
+    return FALSE;
+
+  for ((*dot) = i++; i < length && g_ascii_isdigit (line [i]); ++i);
+return i == length && i > (*dot) + 1;
+}
+
+void web_parser_check (WebParser* self, gsize pending, GError** error)
+{
+  /* a line still waiting for its end counts against the
+   * limits as well, so it can not grow without bound */
+  if (self->got_request_line == FALSE)
+    {
+      if (pending > self->max_request_line)
+        g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_REQUEST_LINE_TOO_LONG, "Request line too long");
+    }
   else
     {
-      self->method = method;
-      path = g_utf8_make_valid (& G_STRUCT_MEMBER (gchar, line, path_start), path_end - path_start);
-      uri = g_uri_parse_relative (patterns->base_uri, path, G_URI_FLAGS_NON_DNS, &tmperr);
-
-      if ((g_free (path)), G_UNLIKELY (tmperr != NULL))
-        g_propagate_error (error, tmperr);
-      else
-        {
-          _g_uri_unref0 (self->uri);
-          self->uri = uri;
-        }
+      if (pending > self->max_header_length || self->header_bytes + pending > self->max_header_bytes)
+        g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_HEADERS_TOO_LARGE, "Header section too large");
     }
 }
 
 void web_parser_clear (WebParser* self)
 {
-  g_queue_clear_full (& self->fields, (GDestroyNotify) web_parser_field_free);
+  g_queue_init (& self->fields);
+  web_arena_clear (& self->arena);
   _g_uri_unref0 (self->uri);
 }
 
@@ -349,6 +315,10 @@ void web_parser_feed (WebParser* self, const gchar* line, gsize length, GError**
     {
       if (length == 0)
         self->complete = TRUE;
+      else if (length > self->max_header_length)
+        g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_HEADERS_TOO_LARGE, "Header field too long");
+      else if ((self->header_bytes += length) > self->max_header_bytes)
+        g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_HEADERS_TOO_LARGE, "Header section too large");
       else
         parse_header_line (self, line, length, error);
     }
@@ -356,7 +326,9 @@ void web_parser_feed (WebParser* self, const gchar* line, gsize length, GError**
     {
       GError* tmperr = NULL;
 
-      if ((parse_request_line (self, line, length, &tmperr)), G_UNLIKELY (tmperr != NULL))
+      if (length > self->max_request_line)
+        g_set_error_literal (error, WEB_PARSER_ERROR, WEB_PARSER_ERROR_REQUEST_LINE_TOO_LONG, "Request line too long");
+      else if ((parse_request_line (self, line, length, &tmperr)), G_UNLIKELY (tmperr != NULL))
         g_propagate_error (error, tmperr);
       else
         {
@@ -368,48 +340,75 @@ void web_parser_feed (WebParser* self, const gchar* line, gsize length, GError**
     }
 }
 
-void web_parser_field_set_name (WebParserField* self, const gchar* name, gsize length)
-{
-  _g_free0 (self->name);
-  self->name = g_ascii_strdown (name, length);
-}
-
-void web_parser_field_add_value (WebParserField* self, const gchar* value, gsize length)
+void web_parser_field_add_value (WebParser* parser, WebParserField* self, const gchar* value, gsize length)
 {
-  gsize oldsz;
+  gchar* old = self->value;
 
   if (self->value == NULL)
     {
       self->valuesz = length;
-      self->value = g_strndup (value, length);
+      self->value = web_arena_strndup (& parser->arena, value, length);
     }
   else
     {
-      oldsz = self->valuesz;
-      self->valuesz += (length + 2);
-      self->value = g_realloc (self->value, (self->valuesz + 1));
+      /* folded lines are rare enough to simply copy
+       * the whole value again, the old one is dropped */
+      self->value = web_arena_alloc (& parser->arena, self->valuesz + length + 3);
+
+      memcpy (& G_STRUCT_MEMBER (gchar, self->value, 0), old, self->valuesz);
+      memcpy (& G_STRUCT_MEMBER (gchar, self->value, self->valuesz + 0), ", ", 2);
+      memcpy (& G_STRUCT_MEMBER (gchar, self->value, self->valuesz + 2), value, length);
 
-      memcpy (& G_STRUCT_MEMBER (gchar, self->value, oldsz + 0), ", ", 2);
-      memcpy (& G_STRUCT_MEMBER (gchar, self->value, oldsz + 2), value, length);
+      self->valuesz += (length + 2);
       G_STRUCT_MEMBER (gchar, self->value, self->valuesz) = 0;
     }
 }
 
-void web_parser_field_free (WebParserField* self)
+void web_parser_field_set_name (WebParser* parser, WebParserField* self, const gchar* name, gsize length)
 {
-  _g_free0 (self->name);
-  _g_free0 (self->value);
-  g_slice_free (WebParserField, self);
+  gsize i;
+
+  /* known names are carried as their id alone */
+  if ((self->field_id = web_message_field_lookup (name, length)) >= 0)
+    self->name = NULL;
+  else
+    {
+      self->name = web_arena_strndup (& parser->arena, name, length);
+
+      for (i = 0; i < length; ++i)
+        self->name [i] = g_ascii_tolower (self->name [i]);
+    }
 }
 
 void web_parser_init (WebParser* self)
 {
+  web_arena_init (& self->arena);
   self->complete = FALSE;
   self->got_request_line = FALSE;
   self->got_simple_request = FALSE;
+  self->header_bytes = 0;
   self->http_version = WEB_HTTP_VERSION_NONE;
+  self->max_header_bytes = G_MAXSIZE;
+  self->max_header_count = G_MAXUINT;
+  self->max_header_length = G_MAXSIZE;
+  self->max_request_line = G_MAXSIZE;
   self->method = NULL;
   self->uri = NULL;
 
   g_queue_init (& self->fields);
 }
+
+void web_parser_reset (WebParser* self)
+{
+  /* keeps the arena's biggest block for the next request */
+  _g_uri_unref0 (self->uri);
+  web_arena_reset (& self->arena);
+  self->complete = FALSE;
+  self->got_request_line = FALSE;
+  self->got_simple_request = FALSE;
+  self->header_bytes = 0;
+  self->http_version = WEB_HTTP_VERSION_NONE;
+  self->method = NULL;
+
+  g_queue_init (& self->fields);
+}
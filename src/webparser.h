@@ -17,6 +17,7 @@
 #ifndef __WEB_PARSER__
 #define __WEB_PARSER__ 1
 #include <glib.h>
+#include <webarena.h>
 
 typedef struct _WebParser WebParser;
 typedef struct _WebParserField WebParserField;
@@ -28,9 +29,15 @@ extern "C" {
 
   struct _WebParser
   {
+    WebArena arena;
     guint complete : 1;
     guint got_simple_request : 1;
     guint got_request_line : 1;
+    gsize header_bytes;
+    gsize max_header_bytes;
+    guint max_header_count;
+    gsize max_header_length;
+    gsize max_request_line;
     const gchar* method;
     GQueue fields;
     GUri* uri;
@@ -39,6 +46,7 @@ extern "C" {
 
   struct _WebParserField
   {
+    gint field_id;
     gchar* name;
     gchar* value;
     gsize valuesz;
@@ -51,15 +59,18 @@ extern "C" {
     WEB_PARSER_ERROR_UNSUPPORTED_VERSION,
     WEB_PARSER_ERROR_MALFORMED_FIELD,
     WEB_PARSER_ERROR_MALFORMED_REQUEST,
+    WEB_PARSER_ERROR_HEADERS_TOO_LARGE,
+    WEB_PARSER_ERROR_REQUEST_LINE_TOO_LONG,
   } WebParserError;
 
   G_GNUC_INTERNAL GQuark web_parser_error_quark (void) G_GNUC_CONST;
+  G_GNUC_INTERNAL void web_parser_check (WebParser* parser, gsize pending, GError** error);
   G_GNUC_INTERNAL void web_parser_clear (WebParser* parser);
   G_GNUC_INTERNAL void web_parser_feed (WebParser* parser, const gchar* line, gsize length, GError** error);
-  G_GNUC_INTERNAL void web_parser_field_set_name (WebParserField* self, const gchar* name, gsize length);
-  G_GNUC_INTERNAL void web_parser_field_add_value (WebParserField* self, const gchar* value, gsize length);
-  G_GNUC_INTERNAL void web_parser_field_free (WebParserField* self);
+  G_GNUC_INTERNAL void web_parser_field_add_value (WebParser* parser, WebParserField* self, const gchar* value, gsize length);
+  G_GNUC_INTERNAL void web_parser_field_set_name (WebParser* parser, WebParserField* self, const gchar* name, gsize length);
   G_GNUC_INTERNAL void web_parser_init (WebParser* parser);
+  G_GNUC_INTERNAL void web_parser_reset (WebParser* parser);
 
 #if __cplusplus
 }
@@ -0,0 +1,250 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <errno.h>
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <webring.h>
+
+typedef struct _WebRingSource WebRingSource;
+static void web_ring_free (WebRing* web_ring);
+static const guint ring_entries = 256;
+
+struct _WebRing
+{
+  gint eventfd;
+  GQueue ops;
+  struct io_uring ring;
+  GSource* source;
+};
+
+struct _WebRingOp
+{
+  WebRingCallback callback;
+  GList link;
+  gpointer user_data;
+};
+
+struct _WebRingSource
+{
+  GSource parent;
+  gpointer tag;
+  WebRing* web_ring;
+};
+
+static WebRing ring_unavailable = {0};
+static GPrivate ring_private = G_PRIVATE_INIT ((GDestroyNotify) web_ring_free);
+
+static void complete (WebRing* web_ring, WebRingOp* op, gint result)
+{
+  g_queue_unlink (& web_ring->ops, & op->link);
+  op->callback (result, op->user_data);
+  g_slice_free (WebRingOp, op);
+}
+
+static gboolean web_ring_source_prepare (GSource* pself, gint* timeout)
+{
+  WebRing* web_ring = ((WebRingSource*) pself)->web_ring;
+
+  /* everything queued by the sources dispatched during the last
+   * iteration goes to the kernel here, in a single io_uring_enter() */
+  if (io_uring_sq_ready (& web_ring->ring) > 0)
+    io_uring_submit (& web_ring->ring);
+return (*timeout = -1, io_uring_cq_ready (& web_ring->ring) > 0);
+}
+
+static gboolean web_ring_source_check (GSource* pself)
+{
+  WebRingSource* self = (gpointer) pself;
+  WebRing* web_ring = self->web_ring;
+return io_uring_cq_ready (& web_ring->ring) > 0 || g_source_query_unix_fd (pself, self->tag) != 0;
+}
+
+static gboolean web_ring_source_dispatch (GSource* pself, GSourceFunc callback, gpointer user_data)
+{
+  WebRing* web_ring = ((WebRingSource*) pself)->web_ring;
+  struct io_uring_cqe* cqe = NULL;
+  guint head, seen = 0;
+  guint64 value;
+
+  while (read (web_ring->eventfd, &value, sizeof (value)) < 0 && errno == EINTR);
+
+  io_uring_for_each_cqe (& web_ring->ring, head, cqe)
+    {
+      WebRingOp* op = io_uring_cqe_get_data (cqe);
+
+      if (op != NULL)
+        complete (web_ring, op, cqe->res);
+      ++seen;
+    }
+
+  io_uring_cq_advance (& web_ring->ring, seen);
+return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs web_ring_source_funcs =
+{
+  .prepare = web_ring_source_prepare,
+  .check = web_ring_source_check,
+  .dispatch = web_ring_source_dispatch,
+};
+
+static WebRing* web_ring_new (void)
+{
+  WebRing* web_ring = g_slice_new0 (WebRing);
+  WebRingSource* source = NULL;
+  gint result;
+
+  if ((result = io_uring_queue_init (ring_entries, & web_ring->ring, 0)) < 0)
+    {
+      g_debug ("io_uring unavailable, using GIO: %s", g_strerror (-result));
+      g_slice_free (WebRing, web_ring);
+      return & ring_unavailable;
+    }
+
+  if ((web_ring->eventfd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+    || (result = io_uring_register_eventfd (& web_ring->ring, web_ring->eventfd)) < 0)
+    {
+      g_debug ("io_uring eventfd unavailable, using GIO: %s", g_strerror (web_ring->eventfd < 0 ? errno : -result));
+
+      if (web_ring->eventfd >= 0)
+        close (web_ring->eventfd);
+
+      io_uring_queue_exit (& web_ring->ring);
+      g_slice_free (WebRing, web_ring);
+      return & ring_unavailable;
+    }
+
+  g_queue_init (& web_ring->ops);
+
+  source = (gpointer) g_source_new (& web_ring_source_funcs, sizeof (WebRingSource));
+  source->tag = g_source_add_unix_fd ((GSource*) source, web_ring->eventfd, G_IO_IN);
+  source->web_ring = web_ring;
+
+  g_source_set_priority ((GSource*) source, G_PRIORITY_DEFAULT);
+#if GLIB_CHECK_VERSION(2, 70, 0)
+  g_source_set_static_name ((GSource*) source, "[WebRing.Source]");
+#else // GLIB_CHECK_VERSION(2, 70, 0)
+  g_source_set_name ((GSource*) source, "[WebRing.Source]");
+#endif // GLIB_CHECK_VERSION(2, 70, 0)
+  g_source_attach ((web_ring->source = (GSource*) source), g_main_context_get_thread_default ());
+return web_ring;
+}
+
+static void web_ring_free (WebRing* web_ring)
+{
+  GList* link = NULL;
+
+  if (web_ring != & ring_unavailable)
+    {
+      g_source_destroy (web_ring->source);
+      g_source_unref (web_ring->source);
+      io_uring_queue_exit (& web_ring->ring);
+      close (web_ring->eventfd);
+
+      /* the kernel dropped whatever was still in flight with the ring */
+      while ((link = g_queue_peek_head_link (& web_ring->ops)) != NULL)
+        complete (web_ring, link->data, -ECANCELED);
+
+      g_slice_free (WebRing, web_ring);
+    }
+}
+
+static struct io_uring_sqe* get_sqe (WebRing* web_ring)
+{
+  struct io_uring_sqe* sqe = NULL;
+
+  if ((sqe = io_uring_get_sqe (& web_ring->ring)) == NULL)
+    {
+      io_uring_submit (& web_ring->ring);
+      sqe = io_uring_get_sqe (& web_ring->ring);
+    }
+return sqe;
+}
+
+static WebRingOp* push_op (WebRing* web_ring, struct io_uring_sqe* sqe, WebRingCallback callback, gpointer user_data)
+{
+  WebRingOp* op = g_slice_new (WebRingOp);
+
+  op->callback = callback;
+  op->link.data = op;
+  op->link.next = NULL;
+  op->link.prev = NULL;
+  op->user_data = user_data;
+
+  io_uring_sqe_set_data (sqe, op);
+  g_queue_push_tail_link (& web_ring->ops, & op->link);
+return op;
+}
+
+WebRing* web_ring_get_thread_default (void)
+{
+  WebRing* web_ring = NULL;
+
+  if ((web_ring = g_private_get (& ring_private)) == NULL)
+    g_private_set (& ring_private, (web_ring = web_ring_new ()));
+return (web_ring == & ring_unavailable) ? NULL : web_ring;
+}
+
+WebRingOp* web_ring_poll (WebRing* web_ring, gint fd, GIOCondition events, WebRingCallback callback, gpointer user_data)
+{
+  g_return_val_if_fail (web_ring != NULL, NULL);
+  g_return_val_if_fail (callback != NULL, NULL);
+  struct io_uring_sqe* sqe = NULL;
+
+  if ((sqe = get_sqe (web_ring)) == NULL)
+    return NULL;
+return (io_uring_prep_poll_add (sqe, fd, (guint) events), push_op (web_ring, sqe, callback, user_data));
+}
+
+WebRingOp* web_ring_recv (WebRing* web_ring, gint fd, gpointer buffer, gsize size, WebRingCallback callback, gpointer user_data)
+{
+  g_return_val_if_fail (web_ring != NULL, NULL);
+  g_return_val_if_fail (callback != NULL, NULL);
+  struct io_uring_sqe* sqe = NULL;
+
+  if ((sqe = get_sqe (web_ring)) == NULL)
+    return NULL;
+return (io_uring_prep_recv (sqe, fd, buffer, size, 0), push_op (web_ring, sqe, callback, user_data));
+}
+
+WebRingOp* web_ring_sendmsg (WebRing* web_ring, gint fd, const struct msghdr* msg, WebRingCallback callback, gpointer user_data)
+{
+  g_return_val_if_fail (web_ring != NULL, NULL);
+  g_return_val_if_fail (msg != NULL, NULL);
+  g_return_val_if_fail (callback != NULL, NULL);
+  struct io_uring_sqe* sqe = NULL;
+
+  if ((sqe = get_sqe (web_ring)) == NULL)
+    return NULL;
+return (io_uring_prep_sendmsg (sqe, fd, msg, MSG_NOSIGNAL), push_op (web_ring, sqe, callback, user_data));
+}
+
+void web_ring_cancel (WebRing* web_ring, WebRingOp* op)
+{
+  g_return_if_fail (web_ring != NULL);
+  g_return_if_fail (op != NULL);
+  struct io_uring_sqe* sqe = NULL;
+
+  /* op itself still completes (with -ECANCELED) through its callback */
+  if ((sqe = get_sqe (web_ring)) != NULL)
+    {
+      io_uring_prep_cancel (sqe, op, 0);
+      io_uring_sqe_set_data (sqe, NULL);
+    }
+}
@@ -0,0 +1,40 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __WEB_RING__
+#define __WEB_RING__ 1
+#include <glib.h>
+#include <sys/socket.h>
+
+typedef struct _WebRing WebRing;
+typedef struct _WebRingOp WebRingOp;
+typedef void (*WebRingCallback) (gint result, gpointer user_data);
+
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  G_GNUC_INTERNAL WebRing* web_ring_get_thread_default (void);
+  G_GNUC_INTERNAL WebRingOp* web_ring_poll (WebRing* web_ring, gint fd, GIOCondition events, WebRingCallback callback, gpointer user_data);
+  G_GNUC_INTERNAL WebRingOp* web_ring_recv (WebRing* web_ring, gint fd, gpointer buffer, gsize size, WebRingCallback callback, gpointer user_data);
+  G_GNUC_INTERNAL WebRingOp* web_ring_sendmsg (WebRing* web_ring, gint fd, const struct msghdr* msg, WebRingCallback callback, gpointer user_data);
+  G_GNUC_INTERNAL void web_ring_cancel (WebRing* web_ring, WebRingOp* op);
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
+#endif // __WEB_RING__
@@ -15,6 +15,8 @@
  * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <config.h>
+#include <glib/gi18n.h>
+#include <gio/gnetworking.h>
 #include <marshals.h>
 #include <webconnection.h>
 #include <webendpoint.h>
@@ -26,11 +28,16 @@
 #define WEB_IS_SERVER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), WEB_TYPE_SERVER))
 #define WEB_SERVER_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), WEB_TYPE_SERVER, WebServerClass))
 typedef struct _WebServerClass WebServerClass;
+G_GNUC_INTERNAL void _web_message_cache_drain (void);
+G_GNUC_INTERNAL void _web_message_set_seqid (WebMessage* web_message, guint seqid);
 #define _g_error_free0(var) ((var == NULL) ? NULL : (var = (g_error_free (var), NULL)))
 #define _g_free0(var) ((var == NULL) ? NULL : (var = (g_free (var), NULL)))
 #define _g_object_unref0(var) ((var == NULL) ? NULL : (var = (g_object_unref (var), NULL)))
+#define _g_ptr_array_unref0(var) ((var == NULL) ? NULL : (var = (g_ptr_array_unref (var), NULL)))
+typedef struct _Handler Handler;
 typedef struct _WebConnection WebConnection;
 typedef union _SignalData SignalData;
+typedef struct _Worker Worker;
 
 struct _WebServer
 {
@@ -38,8 +45,27 @@ struct _WebServer
 
   /* private */
   GMainContext* context;
+  GPtrArray* handlers;
+  GRWLock handlers_lock;
+  WebConnectionLimits limits;
   GQueue listeners;
-  GThreadPool* workers;
+  GMutex listeners_lock;
+  guint listen_backlog;
+  guint max_connections;
+  guint next_handler;
+  guint next_worker;
+  guint n_connections;
+  guint n_workers;
+  guint paused;
+  guint shed_connections;
+  Worker* workers;
+};
+
+struct _Worker
+{
+  GMainContext* context;
+  GMainLoop* main_loop;
+  GThread* thread;
 };
 
 struct _WebServerClass
@@ -47,6 +73,15 @@ struct _WebServerClass
   GObjectClass parent;
 };
 
+struct _Handler
+{
+  guint ref_count;
+  guint id;
+  WebServerHandler func;
+  gpointer user_data;
+  GDestroyNotify notify;
+};
+
 union _SignalData
 {
   GValue values [3];
@@ -56,9 +91,29 @@ union _SignalData
     GValue instance;
     GValue argument;
     GValue connection;
+    guint seqid;
   };
 };
 
+enum
+{
+  prop_0,
+  prop_accepted,
+  prop_connections,
+  prop_dropped,
+  prop_keepalive_timeout,
+  prop_listen_backlog,
+  prop_max_connections,
+  prop_max_header_bytes,
+  prop_max_header_count,
+  prop_max_header_length,
+  prop_max_pipelined,
+  prop_max_request_line,
+  prop_max_requests,
+  prop_shed_connections,
+  prop_number,
+};
+
 enum
 {
   signal_got_failure,
@@ -67,12 +122,119 @@ enum
 };
 
 G_DEFINE_FINAL_TYPE (WebServer, web_server, G_TYPE_OBJECT);
+static GParamSpec* properties [prop_number] = {0};
 static guint signals [signal_number] = {0};
 
+/* sent as-is to connections past max-connections when shedding */
+static const gchar service_unavailable [] =
+  "HTTP/1.1 503 Service Unavailable\r\n"
+  "Connection: close\r\n"
+  "Content-Length: 0\r\n"
+  "Retry-After: 1\r\n"
+  "\r\n";
+
+
+static Handler* handler_ref (Handler* handler)
+{
+  return (g_atomic_int_inc (& handler->ref_count), handler);
+}
+
+static void handler_unref (Handler* handler)
+{
+  if (g_atomic_int_dec_and_test (& handler->ref_count))
+    {
+      if (handler->notify != NULL)
+        handler->notify (handler->user_data);
+      g_slice_free (Handler, handler);
+    }
+}
+
+static GPtrArray* handlers_peek (WebServer* self)
+{
+  GPtrArray* handlers = NULL;
+
+  /* the array itself is never modified once published, writers
+   * swap in a copy, so readers only hold the lock to take a ref */
+  g_rw_lock_reader_lock (& self->handlers_lock);
+
+  if (self->handlers != NULL)
+    handlers = g_ptr_array_ref (self->handlers);
+
+  g_rw_lock_reader_unlock (& self->handlers_lock);
+return handlers;
+}
+
+static void handlers_swap (WebServer* self, GPtrArray* handlers)
+{
+  GPtrArray* old = NULL;
+
+  g_rw_lock_writer_lock (& self->handlers_lock);
+  old = self->handlers;
+  self->handlers = handlers;
+  g_rw_lock_writer_unlock (& self->handlers_lock);
+
+  if (old != NULL)
+    g_ptr_array_unref (old);
+}
+
+static gboolean worker_quit (GMainLoop* main_loop)
+{
+  return (g_main_loop_quit (main_loop), G_SOURCE_REMOVE);
+}
+
+static gpointer worker_main (Worker* worker)
+{
+  g_main_context_push_thread_default (worker->context);
+  g_main_loop_run (worker->main_loop);
+  g_main_context_pop_thread_default (worker->context);
+
+  /* recycled messages go with the worker, not whenever
+   * the thread's private data happens to be torn down */
+  _web_message_cache_drain ();
+return NULL;
+}
+
+static void worker_start (Worker* worker)
+{
+  worker->context = g_main_context_new ();
+  worker->main_loop = g_main_loop_new (worker->context, FALSE);
+  worker->thread = g_thread_new ("web-worker", (GThreadFunc) worker_main, worker);
+}
+
+static void worker_stop (Worker* worker)
+{
+  GSource* source = g_idle_source_new ();
+
+  /* quitting from within the loop itself, as g_main_loop_quit() would
+   * be lost if the worker thread has not started running the loop yet */
+  g_source_set_callback (source, G_SOURCE_FUNC (worker_quit), worker->main_loop, NULL);
+  g_source_attach (source, worker->context);
+  g_source_unref (source);
+
+  g_thread_join (worker->thread);
+  g_main_loop_unref (worker->main_loop);
+  g_main_context_unref (worker->context);
+}
+
 static void web_server_class_dispose (GObject* pself)
 {
   WebServer* self = (gpointer) pself;
+  guint i;
+
+  /* connections torn down along with their workers
+   * must not resume listeners which are going away */
+  g_atomic_int_set (& self->paused, 0);
+
+  /* workers go first, so no endpoint owned by one of them
+   * is accepting while listeners are released below */
+  for (i = 0; i < self->n_workers; ++i)
+    worker_stop (& self->workers [i]);
+
+  self->n_workers = 0;
+  handlers_swap (self, NULL);
+  g_mutex_lock (& self->listeners_lock);
   g_queue_clear_full (& self->listeners, g_object_unref);
+  g_mutex_unlock (& self->listeners_lock);
 G_OBJECT_CLASS (web_server_parent_class)->dispose (pself);
 }
 
@@ -80,26 +242,163 @@ static void web_server_class_finalize (GObject* pself)
 {
   WebServer* self = (gpointer) pself;
   g_main_context_unref (self->context);
-  g_thread_pool_free (self->workers, TRUE, TRUE);
+  g_rw_lock_clear (& self->handlers_lock);
+  g_mutex_clear (& self->listeners_lock);
+  g_free (self->workers);
 G_OBJECT_CLASS (web_server_parent_class)->finalize (pself);
 }
 
+static void web_server_class_get_property (GObject* pself, guint property_id, GValue* value, GParamSpec* pspec)
+{
+  WebServer* self = (gpointer) pself;
+
+  switch (property_id)
+    {
+      case prop_accepted:
+        g_value_set_uint (value, web_server_get_accepted (self));
+        break;
+      case prop_connections:
+        g_value_set_uint (value, web_server_get_connections (self));
+        break;
+      case prop_dropped:
+        g_value_set_uint (value, web_server_get_dropped (self));
+        break;
+      case prop_keepalive_timeout:
+        g_value_set_uint (value, web_server_get_keepalive_timeout (self));
+        break;
+      case prop_listen_backlog:
+        g_value_set_uint (value, web_server_get_listen_backlog (self));
+        break;
+      case prop_max_connections:
+        g_value_set_uint (value, web_server_get_max_connections (self));
+        break;
+      case prop_max_header_bytes:
+        g_value_set_uint (value, web_server_get_max_header_bytes (self));
+        break;
+      case prop_max_header_count:
+        g_value_set_uint (value, web_server_get_max_header_count (self));
+        break;
+      case prop_max_header_length:
+        g_value_set_uint (value, web_server_get_max_header_length (self));
+        break;
+      case prop_max_pipelined:
+        g_value_set_uint (value, web_server_get_max_pipelined (self));
+        break;
+      case prop_max_request_line:
+        g_value_set_uint (value, web_server_get_max_request_line (self));
+        break;
+      case prop_max_requests:
+        g_value_set_uint (value, web_server_get_max_requests (self));
+        break;
+      case prop_shed_connections:
+        g_value_set_boolean (value, web_server_get_shed_connections (self));
+        break;
+
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (pself, property_id, pspec);
+        break;
+    }
+}
+
+static void web_server_class_set_property (GObject* pself, guint property_id, const GValue* value, GParamSpec* pspec)
+{
+  WebServer* self = (gpointer) pself;
+
+  switch (property_id)
+    {
+      case prop_keepalive_timeout:
+        web_server_set_keepalive_timeout (self, g_value_get_uint (value));
+        break;
+      case prop_listen_backlog:
+        web_server_set_listen_backlog (self, g_value_get_uint (value));
+        break;
+      case prop_max_connections:
+        web_server_set_max_connections (self, g_value_get_uint (value));
+        break;
+      case prop_max_header_bytes:
+        web_server_set_max_header_bytes (self, g_value_get_uint (value));
+        break;
+      case prop_max_header_count:
+        web_server_set_max_header_count (self, g_value_get_uint (value));
+        break;
+      case prop_max_header_length:
+        web_server_set_max_header_length (self, g_value_get_uint (value));
+        break;
+      case prop_max_pipelined:
+        web_server_set_max_pipelined (self, g_value_get_uint (value));
+        break;
+      case prop_max_request_line:
+        web_server_set_max_request_line (self, g_value_get_uint (value));
+        break;
+      case prop_max_requests:
+        web_server_set_max_requests (self, g_value_get_uint (value));
+        break;
+      case prop_shed_connections:
+        web_server_set_shed_connections (self, g_value_get_boolean (value));
+        break;
+
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (pself, property_id, pspec);
+        break;
+    }
+}
+
 static void web_server_class_init (WebServerClass* klass)
 {
   G_OBJECT_CLASS (klass)->dispose = web_server_class_dispose;
   G_OBJECT_CLASS (klass)->finalize = web_server_class_finalize;
+  G_OBJECT_CLASS (klass)->get_property = web_server_class_get_property;
+  G_OBJECT_CLASS (klass)->set_property = web_server_class_set_property;
 
   const GType gtype = G_TYPE_FROM_CLASS (klass);
+  const GParamFlags flags3 = G_PARAM_READABLE | G_PARAM_STATIC_STRINGS;
+  const GParamFlags flags4 = G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS;
   const GSignalFlags flags1 = G_SIGNAL_RUN_LAST;
   const GSignalFlags flags2 = G_SIGNAL_RUN_LAST;
   const GSignalAccumulator accum1 = g_signal_accumulator_true_handled;
   const GSignalCMarshaller marshaller1 = web_cclosure_marshal_VOID__BOXED;
   const GSignalCMarshaller marshaller2 = web_cclosure_marshal_BOOLEAN__OBJECT;
 
+  properties [prop_accepted] = g_param_spec_uint ("accepted", "accepted", "accepted", 0, G_MAXUINT, 0, flags3);
+  properties [prop_connections] = g_param_spec_uint ("connections", "connections", "connections", 0, G_MAXUINT, 0, flags3);
+  properties [prop_dropped] = g_param_spec_uint ("dropped", "dropped", "dropped", 0, G_MAXUINT, 0, flags3);
+  properties [prop_keepalive_timeout] = g_param_spec_uint ("keepalive-timeout", "keepalive-timeout", "keepalive-timeout", 1, G_MAXINT, 6, flags4);
+  properties [prop_listen_backlog] = g_param_spec_uint ("listen-backlog", "listen-backlog", "listen-backlog", 1, G_MAXINT, 128, flags4);
+  properties [prop_max_connections] = g_param_spec_uint ("max-connections", "max-connections", "max-connections", 1, G_MAXUINT, G_MAXUINT, flags4);
+  properties [prop_max_header_bytes] = g_param_spec_uint ("max-header-bytes", "max-header-bytes", "max-header-bytes", 1, G_MAXUINT, 32768, flags4);
+  properties [prop_max_header_count] = g_param_spec_uint ("max-header-count", "max-header-count", "max-header-count", 1, G_MAXUINT, 100, flags4);
+  properties [prop_max_header_length] = g_param_spec_uint ("max-header-length", "max-header-length", "max-header-length", 1, G_MAXUINT, 8192, flags4);
+  properties [prop_max_pipelined] = g_param_spec_uint ("max-pipelined", "max-pipelined", "max-pipelined", 1, WEB_CONNECTION_MAX_PIPELINED, 16, flags4);
+  properties [prop_max_request_line] = g_param_spec_uint ("max-request-line", "max-request-line", "max-request-line", 1, G_MAXUINT, 8192, flags4);
+  properties [prop_max_requests] = g_param_spec_uint ("max-requests", "max-requests", "max-requests", 1, G_MAXUINT, G_MAXUINT, flags4);
+  properties [prop_shed_connections] = g_param_spec_boolean ("shed-connections", "shed-connections", "shed-connections", FALSE, flags4);
+  g_object_class_install_properties (G_OBJECT_CLASS (klass), prop_number, properties);
   signals [signal_got_failure] = g_signal_new ("got-failure", gtype, flags1, 0, NULL, NULL, marshaller1, G_TYPE_NONE, 1, G_TYPE_ERROR);
   signals [signal_got_request] = g_signal_new ("got-request", gtype, flags2, 0, accum1, NULL, marshaller2, G_TYPE_BOOLEAN, 1, WEB_TYPE_MESSAGE);
 }
 
+static const WebConnectionLimits* limits_peek (WebServer* self, WebConnectionLimits* limits)
+{
+  limits->keepalive_timeout = g_atomic_int_get (& self->limits.keepalive_timeout);
+  limits->max_header_bytes = g_atomic_int_get (& self->limits.max_header_bytes);
+  limits->max_header_count = g_atomic_int_get (& self->limits.max_header_count);
+  limits->max_header_length = g_atomic_int_get (& self->limits.max_header_length);
+  limits->max_pipelined = g_atomic_int_get (& self->limits.max_pipelined);
+  limits->max_request_line = g_atomic_int_get (& self->limits.max_request_line);
+  limits->max_requests = g_atomic_int_get (& self->limits.max_requests);
+return limits;
+}
+
+static void limit_set (WebServer* self, guint* limit, guint value, guint property_id)
+{
+  /* only connections accepted from now on pick up the new value */
+  if (g_atomic_int_get (limit) != value)
+    {
+      g_atomic_int_set (limit, value);
+      g_object_notify_by_pspec (G_OBJECT (self), properties [property_id]);
+    }
+}
+
 static gboolean do_got_failure (gpointer values)
 {
   GError* tmperr = g_value_get_boxed (G_STRUCT_MEMBER_P (values, G_STRUCT_OFFSET (SignalData, argument)));
@@ -107,11 +406,23 @@ static gboolean do_got_failure (gpointer values)
   WebMessage* web_message = web_message_new ();
   WebServer* web_server = g_value_get_object (G_STRUCT_MEMBER_P (values, G_STRUCT_OFFSET (SignalData, instance)));
 
+  /* answered in turn, after whatever was parsed before the failure */
+  _web_message_set_seqid (web_message, G_STRUCT_MEMBER (guint, values, G_STRUCT_OFFSET (SignalData, seqid)));
   web_message_set_http_version (web_message, WEB_HTTP_VERSION_1_1);
   web_message_set_is_closure (web_message, TRUE);
   g_signal_emitv (values, signals [signal_got_failure], 0, NULL);
 
-  if (tmperr->domain == WEB_PARSER_ERROR || g_error_matches (tmperr, WEB_CONNECTION_ERROR, WEB_CONNECTION_ERROR_MISMATCH_VERSION))
+  if (g_error_matches (tmperr, WEB_PARSER_ERROR, WEB_PARSER_ERROR_HEADERS_TOO_LARGE))
+    {
+      web_message_set_status_full (web_message, WEB_STATUS_CODE_REQUEST_HEADER_FIELDS_TOO_LARGE, "request header fields too large");
+      web_message_set_is_closure (web_message, TRUE);
+    }
+  else if (g_error_matches (tmperr, WEB_PARSER_ERROR, WEB_PARSER_ERROR_REQUEST_LINE_TOO_LONG))
+    {
+      web_message_set_status_full (web_message, WEB_STATUS_CODE_URI_TOO_LONG, "uri too long");
+      web_message_set_is_closure (web_message, TRUE);
+    }
+  else if (tmperr->domain == WEB_PARSER_ERROR || g_error_matches (tmperr, WEB_CONNECTION_ERROR, WEB_CONNECTION_ERROR_MISMATCH_VERSION))
     {
       web_message_set_status_full (web_message, WEB_STATUS_CODE_BAD_REQUEST, "bad request");
       web_message_set_is_closure (web_message, TRUE);
@@ -156,6 +467,11 @@ static gboolean do_got_request (gpointer values)
 return (g_value_unset (handled), G_SOURCE_REMOVE);
 }
 
+static gboolean do_failed_connection (gpointer values)
+{
+  return (g_signal_emitv (values, signals [signal_got_failure], 0, NULL), G_SOURCE_REMOVE);
+}
+
 static void signal_data_unref (gpointer ptr)
 {
   g_value_unset (& G_STRUCT_MEMBER (GValue, ptr, G_STRUCT_OFFSET (SignalData, values [0])));
@@ -164,59 +480,124 @@ static void signal_data_unref (gpointer ptr)
   g_slice_free (SignalData, ptr);
 }
 
-static void process (WebConnection* web_connection, WebServer* self)
+static void dispatch (WebServer* self, WebConnection* web_connection, WebMessage* web_message, GPtrArray* handlers)
+{
+  Handler* handler = NULL;
+  gboolean handled = FALSE;
+  guint i;
+
+  for (i = 0; i < handlers->len && handled == FALSE; ++i)
+    {
+      handler = g_ptr_array_index (handlers, i);
+      handled = handler->func (self, web_message, handler->user_data);
+    }
+
+  if (handled == FALSE)
+    {
+      web_message_set_is_closure (web_message, TRUE);
+      web_message_set_status (web_message, WEB_STATUS_CODE_NOT_IMPLEMENTED);
+    }
+
+  web_connection_send (web_connection, web_message);
+}
+
+static gboolean process (WebConnection* web_connection, WebServer* self)
 {
+  GPtrArray* handlers = NULL;
   WebMessage* web_message = NULL;
   GError* tmperr = NULL;
+  guint i, n_steps;
+
+  /* every complete request already buffered is handed out in this
+   * same pass, the connection itself stops yielding messages once
+   * max-pipelined of them are in flight */
+  n_steps = g_atomic_int_get (& self->limits.max_pipelined);
 
-  if ((web_message = web_connection_step (web_connection, &tmperr)), G_UNLIKELY (tmperr != NULL))
+  for (i = 0; i < n_steps; ++i)
     {
-      if (g_error_matches (tmperr, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED))
+      if ((web_message = web_connection_step (web_connection, &tmperr)), G_UNLIKELY (tmperr != NULL))
         {
-          g_object_unref (web_connection);
-          g_error_free (tmperr);
-        }
-      else
-        {
-          SignalData* data = g_slice_new0 (SignalData);
+          GError* tmperr2 = NULL;
+          guint seqid = 0;
 
-          g_value_init (& data->argument, G_TYPE_ERROR);
-          g_value_take_boxed (& data->argument, tmperr);
-          g_value_init_from_instance (& data->connection, web_connection);
-          g_value_init_from_instance (& data->instance, self);
+          /* only a bad request is answered, and only while the reply has
+           * a place in the connection's queue; the connection itself has
+           * already been closed for anything else (see web_connection_step) */
+          if (tmperr->domain != WEB_PARSER_ERROR && tmperr->domain != WEB_CONNECTION_ERROR)
+            {
+              _g_ptr_array_unref0 (handlers);
+              g_error_free (tmperr);
+              return G_SOURCE_REMOVE;
+            }
+          else if ((seqid = web_connection_reserve (web_connection, &tmperr2)), G_UNLIKELY (tmperr2 != NULL))
+            {
+              g_debug ("(" G_STRLOC "): %s: %s", tmperr->message, tmperr2->message);
+              _g_ptr_array_unref0 (handlers);
+              g_error_free (tmperr2);
+              g_error_free (tmperr);
+              return G_SOURCE_REMOVE;
+            }
+          else
+            {
+              SignalData* data = g_slice_new0 (SignalData);
 
-          g_main_context_invoke_full (self->context, G_PRIORITY_HIGH_IDLE, G_SOURCE_FUNC (do_got_failure), data, signal_data_unref);
-          g_thread_pool_push (self->workers, web_connection, NULL);
+              g_value_init (& data->argument, G_TYPE_ERROR);
+              g_value_take_boxed (& data->argument, tmperr);
+              g_value_init_from_instance (& data->connection, web_connection);
+              g_value_init_from_instance (& data->instance, self);
+              data->seqid = seqid;
+
+              g_main_context_invoke_full (self->context, G_PRIORITY_HIGH_IDLE, G_SOURCE_FUNC (do_got_failure), data, signal_data_unref);
+              break;
+            }
         }
-    }
-  else
-    {
-      if (web_message != NULL)
+      else if (web_message == NULL)
+        break;
+      else
         {
-          SignalData* data = g_slice_new0 (SignalData);
+          if (handlers == NULL)
+            handlers = handlers_peek (self);
 
-          g_value_init_from_instance (& data->argument, web_message);
-          g_value_init_from_instance (& data->connection, web_connection);
-          g_value_init_from_instance (& data->instance, self);
-          g_object_unref (web_message);
+          if (handlers != NULL)
+            {
+              /* handlers registered through web_server_add_handler () run
+               * right here, on the worker that parsed the request */
+              dispatch (self, web_connection, web_message, handlers);
+              g_object_unref (web_message);
+            }
+          else
+            {
+              SignalData* data = g_slice_new0 (SignalData);
 
-          g_main_context_invoke_full (self->context, G_PRIORITY_HIGH_IDLE, G_SOURCE_FUNC (do_got_request), data, signal_data_unref);
-        }
+              g_value_init_from_instance (& data->argument, web_message);
+              g_value_init_from_instance (& data->connection, web_connection);
+              g_value_init_from_instance (& data->instance, self);
+              g_object_unref (web_message);
 
-      g_thread_pool_push (self->workers, web_connection, NULL);
+              g_main_context_invoke_full (self->context, G_PRIORITY_HIGH_IDLE, G_SOURCE_FUNC (do_got_request), data, signal_data_unref);
+            }
+        }
     }
+return (_g_ptr_array_unref0 (handlers), G_SOURCE_CONTINUE);
 }
 
 static void web_server_init (WebServer* self)
 {
-  g_queue_init (& self->listeners);
+  guint i;
 
-  const GFunc func1 = (GFunc) process;
-  const GDestroyNotify notify = (GDestroyNotify) g_object_unref;
-  const guint max_threads = g_get_num_processors ();
+  g_queue_init (& self->listeners);
+  g_mutex_init (& self->listeners_lock);
+  g_rw_lock_init (& self->handlers_lock);
 
   self->context = g_main_context_ref_thread_default ();
-  self->workers = g_thread_pool_new_full (func1, self, notify, max_threads, FALSE, NULL);
+  self->handlers = NULL;
+  self->next_handler = 0;
+  self->next_worker = 0;
+  self->n_workers = MAX (1, g_get_num_processors ());
+  self->workers = g_new (Worker, self->n_workers);
+
+  for (i = 0; i < self->n_workers; ++i)
+    worker_start (& self->workers [i]);
 }
 
 WebServer* web_server_new ()
@@ -224,25 +605,135 @@ WebServer* web_server_new ()
   return g_object_new (WEB_TYPE_SERVER, NULL);
 }
 
+static void listeners_pause (WebServer* self)
+{
+  GList* list;
+
+  /* workers pause and resume as connections come and go while the
+   * main thread may be adding listeners, so the flag and the list
+   * only change together, under the lock */
+  g_mutex_lock (& self->listeners_lock);
+
+  if (g_atomic_int_get (& self->paused) == FALSE)
+    {
+      g_atomic_int_set (& self->paused, TRUE);
+
+      /* a connection closed before the flag was set saw nothing to
+       * resume, so the count is looked at again only after setting it */
+      if ((guint) g_atomic_int_get (& self->n_connections) < (guint) g_atomic_int_get (& self->max_connections))
+        g_atomic_int_set (& self->paused, FALSE);
+      else
+        {
+          for (list = self->listeners.head; list; list = list->next)
+            web_endpoint_pause (list->data);
+        }
+    }
+
+  g_mutex_unlock (& self->listeners_lock);
+}
+
+static void listeners_resume (WebServer* self)
+{
+  GList* list;
+
+  g_mutex_lock (& self->listeners_lock);
+
+  if (g_atomic_int_get (& self->paused) == TRUE)
+    {
+      for (list = self->listeners.head; list; list = list->next)
+        web_endpoint_resume (list->data);
+      g_atomic_int_set (& self->paused, FALSE);
+    }
+
+  g_mutex_unlock (& self->listeners_lock);
+}
+
+static void on_connection_closed (WebServer* self)
+{
+  guint active = (guint) g_atomic_int_add (& self->n_connections, -1) - 1;
+
+  if (active < (guint) g_atomic_int_get (& self->max_connections))
+    {
+      if (g_atomic_int_get (& self->paused))
+        listeners_resume (self);
+    }
+}
+
+static gboolean admit (WebServer* self, GSocket* client_socket)
+{
+  guint active = (guint) g_atomic_int_add (& self->n_connections, 1) + 1;
+  guint limit = (guint) g_atomic_int_get (& self->max_connections);
+
+  if (G_UNLIKELY (active > limit))
+    {
+      g_atomic_int_add (& self->n_connections, -1);
+
+      /* best effort, the endpoint closes the socket right after */
+      if (g_atomic_int_get (& self->shed_connections))
+        g_socket_send (client_socket, service_unavailable, sizeof (service_unavailable) - 1, NULL, NULL);
+      return FALSE;
+    }
+
+  /* with shedding off, last admitted connection stops accepting
+   * until one of them goes away (see on_connection_closed()) */
+  if (active == limit && g_atomic_int_get (& self->shed_connections) == FALSE)
+    {
+      if (g_atomic_int_get (& self->paused) == FALSE)
+        listeners_pause (self);
+    }
+return TRUE;
+}
+
 static gboolean on_new_connection (WebServer* self, GSocket* client_socket, WebEndpoint* web_endpoint)
 {
   gboolean is_https = web_endpoint_get_is_https (web_endpoint);
-  WebConnection* web_connection = web_connection_new (client_socket, is_https);
-return (g_thread_pool_push (self->workers, web_connection, NULL), TRUE);
+  GMainContext* context = web_endpoint_get_context (web_endpoint);
+  WebConnection* web_connection = NULL;
+  GSource* source = NULL;
+  WebConnectionLimits limits;
+
+  if (admit (self, client_socket) == FALSE)
+    return FALSE;
+
+  web_connection = web_connection_new (client_socket, is_https);
+  source = web_connection_create_source (web_connection);
+
+  if (context == self->context)
+    {
+      guint next = (guint) g_atomic_int_add (& self->next_worker, 1);
+      context = self->workers [next % self->n_workers].context;
+    }
+
+  web_connection_set_limits (web_connection, limits_peek (self, &limits));
+  g_source_set_callback (source, G_SOURCE_FUNC (process), self, (GDestroyNotify) on_connection_closed);
+  g_source_attach (source, context);
+  g_source_unref (source);
+return (g_object_unref (web_connection), TRUE);
 }
 
-static gboolean on_failed_connection (WebServer* self, GError* tmperr)
+static gboolean on_failed_connection (WebServer* self, GError* tmperr, WebEndpoint* web_endpoint)
 {
-  return (g_signal_emit (self, signals [signal_got_failure], 0, tmperr), TRUE);
+  if (web_endpoint_get_context (web_endpoint) == self->context)
+    g_signal_emit (self, signals [signal_got_failure], 0, tmperr);
+  else
+    {
+      SignalData* data = g_slice_new0 (SignalData);
+
+      g_value_init (& data->argument, G_TYPE_ERROR);
+      g_value_set_boxed (& data->argument, tmperr);
+      g_value_init (& data->connection, G_TYPE_OBJECT);
+      g_value_init_from_instance (& data->instance, self);
+
+      g_main_context_invoke_full (self->context, G_PRIORITY_HIGH_IDLE, G_SOURCE_FUNC (do_failed_connection), data, signal_data_unref);
+    }
+return TRUE;
 }
 
-static GSocket* listen_internal (WebServer* self, GSocketAddress* socket_address, WebListenOptions options, GError** error)
+static GSocket* listen_socket (GSocketAddress* socket_address, guint backlog, gboolean reuse_port, GError** error)
 {
-  WebEndpoint* web_endpoint;
   GSocket* socket = NULL;
   GError* tmperr = NULL;
 
-  const gboolean is_https = ! ((options & WEB_LISTEN_OPTION_HTTPS) == 0);
   const GSocketFamily socket_family = g_socket_address_get_family (socket_address);
   const GSocketType socket_type = G_SOCKET_TYPE_STREAM;
   const GSocketProtocol socket_proto = G_SOCKET_PROTOCOL_TCP;
@@ -255,7 +746,27 @@ static GSocket* listen_internal (WebServer* self, GSocketAddress* socket_address
     }
 
   g_socket_set_blocking (socket, FALSE);
-  g_socket_set_listen_backlog (socket, 3);
+  g_socket_set_listen_backlog (socket, (gint) backlog);
+
+  if (reuse_port == TRUE)
+    {
+#ifdef SO_REUSEPORT
+      /* reported as not supported whatever the errno (EINVAL, ENOPROTOOPT),
+       * so callers fall back to a single listener just as they do when
+       * the platform lacks the option altogether */
+      if ((g_socket_set_option (socket, SOL_SOCKET, SO_REUSEPORT, TRUE, &tmperr)), G_UNLIKELY (tmperr != NULL))
+        {
+          _g_object_unref0 (socket);
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, _("SO_REUSEPORT is not supported: %s"), tmperr->message);
+          g_error_free (tmperr);
+          return NULL;
+        }
+#else // !SO_REUSEPORT
+      _g_object_unref0 (socket);
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, _("SO_REUSEPORT is not supported on this platform"));
+      return NULL;
+#endif // SO_REUSEPORT
+    }
 
   if ((g_socket_bind (socket, socket_address, TRUE, &tmperr)), G_UNLIKELY (tmperr != NULL))
     {
@@ -270,18 +781,369 @@ static GSocket* listen_internal (WebServer* self, GSocketAddress* socket_address
       g_propagate_error (error, tmperr);
       return NULL;
     }
+return socket;
+}
+
+static gboolean listener_drop (WebEndpoint* web_endpoint)
+{
+  return (g_object_unref (web_endpoint), G_SOURCE_REMOVE);
+}
+
+static void listeners_drop (GQueue* listeners)
+{
+  WebEndpoint* web_endpoint;
 
-  if ((web_endpoint = web_endpoint_new (socket, is_https, &tmperr), g_object_unref (socket)), G_UNLIKELY (tmperr != NULL))
+  /* released from their own context, which may be running
+   * accept_source() on them right now */
+  while ((web_endpoint = g_queue_pop_head (listeners)) != NULL)
     {
-      _g_object_unref0 (web_endpoint);
-      g_propagate_error (error, tmperr);
-      return NULL;
+      web_endpoint_pause (web_endpoint);
+      g_main_context_invoke (web_endpoint_get_context (web_endpoint), G_SOURCE_FUNC (listener_drop), web_endpoint);
+    }
+}
+
+static GSocket* listen_internal (WebServer* self, GSocketAddress* socket_address, WebListenOptions options, GError** error)
+{
+  WebEndpoint* web_endpoint;
+  GSocketAddress* bound = NULL;
+  GSocket* first = NULL;
+  GQueue listeners = G_QUEUE_INIT;
+  GSocket** sockets = NULL;
+  GError* tmperr = NULL;
+  guint i, n_shards;
+
+  const gboolean is_https = ! ((options & WEB_LISTEN_OPTION_HTTPS) == 0);
+  const gboolean reuse_port = ! ((options & WEB_LISTEN_OPTION_REUSE_PORT) == 0);
+
+  /* with WEB_LISTEN_OPTION_REUSE_PORT every worker gets its own listening
+   * socket bound to the same address, and the kernel spreads incoming
+   * connections among them; accepted sockets stay on the accepting worker */
+  n_shards = (reuse_port == FALSE) ? 1 : self->n_workers;
+  sockets = g_new0 (GSocket*, n_shards);
+
+  /* every shard is listening before any of them starts accepting, so
+   * a failure half way leaves nothing registered; shards after the
+   * first bind the address it got, which differs from the one asked
+   * for when that had port 0 */
+  for (i = 0; i < n_shards; ++i)
+    {
+      if ((sockets [i] = listen_socket (i == 0 ? socket_address : bound, self->listen_backlog, reuse_port, &tmperr)), G_UNLIKELY (tmperr == NULL))
+        {
+          if (i == 0 && n_shards > 1)
+            bound = g_socket_get_local_address (sockets [0], &tmperr);
+        }
+
+      if (G_UNLIKELY (tmperr != NULL))
+        {
+          for (i = 0; i < n_shards; ++i)
+            _g_object_unref0 (sockets [i]);
+
+          _g_object_unref0 (bound);
+          g_propagate_error (error, tmperr);
+          g_free (sockets);
+          return NULL;
+        }
+    }
+
+  for (i = 0; i < n_shards; ++i)
+    {
+      GMainContext* context = (reuse_port == FALSE) ? self->context : self->workers [i].context;
+
+      if ((web_endpoint = web_endpoint_new (sockets [i], is_https, context, &tmperr)), G_UNLIKELY (tmperr != NULL))
+        {
+          for (i = 0; i < n_shards; ++i)
+            _g_object_unref0 (sockets [i]);
+
+          listeners_drop (& listeners);
+          _g_object_unref0 (bound);
+          _g_object_unref0 (web_endpoint);
+          g_propagate_error (error, tmperr);
+          g_free (sockets);
+          return NULL;
+        }
+
+      g_signal_connect_swapped (web_endpoint, "new-connection", G_CALLBACK (on_new_connection), self);
+      g_signal_connect_swapped (web_endpoint, "failed-connection", G_CALLBACK (on_failed_connection), self);
+      g_queue_push_tail (& listeners, web_endpoint);
+    }
+
+  first = web_endpoint_get_socket (g_queue_peek_head (& listeners));
+
+  g_mutex_lock (& self->listeners_lock);
+
+  while ((web_endpoint = g_queue_pop_head (& listeners)) != NULL)
+    {
+      /* joining while accepting is paused */
+      if (g_atomic_int_get (& self->paused))
+        web_endpoint_pause (web_endpoint);
+      g_queue_push_head (& self->listeners, web_endpoint);
+    }
+
+  g_mutex_unlock (& self->listeners_lock);
+
+  for (i = 0; i < n_shards; ++i)
+    g_object_unref (sockets [i]);
+
+  _g_object_unref0 (bound);
+  g_free (sockets);
+return first;
+}
+
+guint web_server_add_handler (WebServer* web_server, WebServerHandler func, gpointer user_data, GDestroyNotify notify)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+  g_return_val_if_fail (func != NULL, 0);
+  WebServer* self = (web_server);
+  GPtrArray* handlers = NULL;
+  GPtrArray* old = NULL;
+  Handler* handler = NULL;
+  guint i;
+
+  handler = g_slice_new (Handler);
+  handler->ref_count = 1;
+  handler->id = (guint) g_atomic_int_add (& self->next_handler, 1) + 1;
+  handler->func = func;
+  handler->user_data = user_data;
+  handler->notify = notify;
+
+  g_rw_lock_writer_lock (& self->handlers_lock);
+  handlers = g_ptr_array_new_with_free_func ((GDestroyNotify) handler_unref);
+
+  if ((old = self->handlers) != NULL)
+  for (i = 0; i < old->len; ++i)
+    g_ptr_array_add (handlers, handler_ref (g_ptr_array_index (old, i)));
+
+  g_ptr_array_add (handlers, handler);
+  self->handlers = handlers;
+  g_rw_lock_writer_unlock (& self->handlers_lock);
+
+  if (old != NULL)
+    g_ptr_array_unref (old);
+return handler->id;
+}
+
+guint web_server_get_accepted (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+  GList* list;
+  guint accepted = 0;
+
+  g_mutex_lock (& web_server->listeners_lock);
+
+  for (list = web_server->listeners.head; list; list = list->next)
+    accepted += web_endpoint_get_accepted (list->data);
+
+  g_mutex_unlock (& web_server->listeners_lock);
+return accepted;
+}
+
+guint web_server_get_connections (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->n_connections);
+}
+
+guint web_server_get_dropped (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+  GList* list;
+  guint dropped = 0;
+
+  g_mutex_lock (& web_server->listeners_lock);
+
+  for (list = web_server->listeners.head; list; list = list->next)
+    dropped += web_endpoint_get_dropped (list->data);
+
+  g_mutex_unlock (& web_server->listeners_lock);
+return dropped;
+}
+
+guint web_server_get_keepalive_timeout (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->limits.keepalive_timeout);
+}
+
+guint web_server_get_listen_backlog (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return web_server->listen_backlog;
+}
+
+guint web_server_get_max_connections (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->max_connections);
+}
+
+guint web_server_get_max_header_bytes (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->limits.max_header_bytes);
+}
+
+guint web_server_get_max_header_count (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->limits.max_header_count);
+}
+
+guint web_server_get_max_header_length (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->limits.max_header_length);
+}
+
+guint web_server_get_max_pipelined (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->limits.max_pipelined);
+}
+
+guint web_server_get_max_request_line (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->limits.max_request_line);
+}
+
+guint web_server_get_max_requests (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), 0);
+return g_atomic_int_get (& web_server->limits.max_requests);
+}
+
+gboolean web_server_get_shed_connections (WebServer* web_server)
+{
+  g_return_val_if_fail (WEB_IS_SERVER (web_server), FALSE);
+return g_atomic_int_get (& web_server->shed_connections);
+}
+
+void web_server_remove_handler (WebServer* web_server, guint handler_id)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (handler_id > 0);
+  WebServer* self = (web_server);
+  GPtrArray* handlers = NULL;
+  GPtrArray* old = NULL;
+  Handler* handler = NULL;
+  guint i;
+
+  g_rw_lock_writer_lock (& self->handlers_lock);
+
+  if ((old = self->handlers) != NULL)
+    {
+      handlers = g_ptr_array_new_with_free_func ((GDestroyNotify) handler_unref);
+
+      for (i = 0; i < old->len; ++i)
+      if ((handler = g_ptr_array_index (old, i))->id != handler_id)
+        g_ptr_array_add (handlers, handler_ref (handler));
+
+      /* an empty set sends requests back through got-request */
+      if (handlers->len == 0)
+        g_clear_pointer (&handlers, g_ptr_array_unref);
+      self->handlers = handlers;
+    }
+
+  g_rw_lock_writer_unlock (& self->handlers_lock);
+
+  if (old != NULL)
+    g_ptr_array_unref (old);
+}
+
+void web_server_set_keepalive_timeout (WebServer* web_server, guint keepalive_timeout)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (keepalive_timeout > 0 && keepalive_timeout <= G_MAXINT);
+  limit_set (web_server, & web_server->limits.keepalive_timeout, keepalive_timeout, prop_keepalive_timeout);
+}
+
+void web_server_set_listen_backlog (WebServer* web_server, guint backlog)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (backlog > 0 && backlog <= G_MAXINT);
+
+  if (web_server->listen_backlog != backlog)
+    {
+      web_server->listen_backlog = backlog;
+      g_object_notify_by_pspec (G_OBJECT (web_server), properties [prop_listen_backlog]);
     }
+}
+
+void web_server_set_max_connections (WebServer* web_server, guint max_connections)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (max_connections > 0);
+  WebServer* self = (web_server);
+
+  if (g_atomic_int_get (& self->max_connections) != max_connections)
+    {
+      g_atomic_int_set (& self->max_connections, max_connections);
+      g_object_notify_by_pspec (G_OBJECT (self), properties [prop_max_connections]);
+
+      if ((guint) g_atomic_int_get (& self->n_connections) < max_connections)
+        {
+          if (g_atomic_int_get (& self->paused))
+            listeners_resume (self);
+        }
+    }
+}
+
+void web_server_set_max_header_bytes (WebServer* web_server, guint max_header_bytes)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (max_header_bytes > 0);
+  limit_set (web_server, & web_server->limits.max_header_bytes, max_header_bytes, prop_max_header_bytes);
+}
 
-  g_signal_connect_swapped (web_endpoint, "new-connection", G_CALLBACK (on_new_connection), self);
-  g_signal_connect_swapped (web_endpoint, "failed-connection", G_CALLBACK (on_failed_connection), self);
-  g_queue_push_head (& self->listeners, web_endpoint);
-return (web_endpoint_get_socket (web_endpoint));
+void web_server_set_max_header_count (WebServer* web_server, guint max_header_count)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (max_header_count > 0);
+  limit_set (web_server, & web_server->limits.max_header_count, max_header_count, prop_max_header_count);
+}
+
+void web_server_set_max_header_length (WebServer* web_server, guint max_header_length)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (max_header_length > 0);
+  limit_set (web_server, & web_server->limits.max_header_length, max_header_length, prop_max_header_length);
+}
+
+void web_server_set_max_pipelined (WebServer* web_server, guint max_pipelined)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (max_pipelined > 0 && max_pipelined <= WEB_CONNECTION_MAX_PIPELINED);
+  limit_set (web_server, & web_server->limits.max_pipelined, max_pipelined, prop_max_pipelined);
+}
+
+void web_server_set_max_request_line (WebServer* web_server, guint max_request_line)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (max_request_line > 0);
+  limit_set (web_server, & web_server->limits.max_request_line, max_request_line, prop_max_request_line);
+}
+
+void web_server_set_max_requests (WebServer* web_server, guint max_requests)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  g_return_if_fail (max_requests > 0);
+  limit_set (web_server, & web_server->limits.max_requests, max_requests, prop_max_requests);
+}
+
+void web_server_set_shed_connections (WebServer* web_server, gboolean shed_connections)
+{
+  g_return_if_fail (WEB_IS_SERVER (web_server));
+  WebServer* self = (web_server);
+
+  if (g_atomic_int_get (& self->shed_connections) != (shed_connections = !!shed_connections))
+    {
+      g_atomic_int_set (& self->shed_connections, shed_connections);
+      g_object_notify_by_pspec (G_OBJECT (self), properties [prop_shed_connections]);
+
+      /* shedding answers past the limit, so nothing should stay paused */
+      if (shed_connections && g_atomic_int_get (& self->paused))
+        listeners_resume (self);
+    }
 }
 
 void web_server_listen (WebServer* web_server, GSocketAddress* address, WebListenOptions options, GError** error)
@@ -18,11 +18,13 @@
 #define __WEB_SERVER__ 1
 #include <gio/gio.h>
 #include <weblistenoptions.h>
+#include <webmessage.h>
 
 #define WEB_TYPE_SERVER (web_server_get_type ())
 #define WEB_SERVER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), WEB_TYPE_SERVER, WebServer))
 #define WEB_IS_SERVER(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WEB_TYPE_SERVER))
 typedef struct _WebServer WebServer;
+typedef gboolean (*WebServerHandler) (WebServer* web_server, WebMessage* web_message, gpointer user_data);
 
 #if __cplusplus
 extern "C" {
@@ -30,6 +32,31 @@ extern "C" {
 
   G_GNUC_INTERNAL GType web_server_get_type (void) G_GNUC_CONST;
   G_GNUC_INTERNAL WebServer* web_server_new ();
+  G_GNUC_INTERNAL guint web_server_add_handler (WebServer* web_server, WebServerHandler func, gpointer user_data, GDestroyNotify notify);
+  G_GNUC_INTERNAL guint web_server_get_accepted (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_connections (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_dropped (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_keepalive_timeout (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_listen_backlog (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_max_connections (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_max_header_bytes (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_max_header_count (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_max_header_length (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_max_pipelined (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_max_request_line (WebServer* web_server);
+  G_GNUC_INTERNAL guint web_server_get_max_requests (WebServer* web_server);
+  G_GNUC_INTERNAL gboolean web_server_get_shed_connections (WebServer* web_server);
+  G_GNUC_INTERNAL void web_server_remove_handler (WebServer* web_server, guint handler_id);
+  G_GNUC_INTERNAL void web_server_set_keepalive_timeout (WebServer* web_server, guint keepalive_timeout);
+  G_GNUC_INTERNAL void web_server_set_listen_backlog (WebServer* web_server, guint backlog);
+  G_GNUC_INTERNAL void web_server_set_max_connections (WebServer* web_server, guint max_connections);
+  G_GNUC_INTERNAL void web_server_set_max_header_bytes (WebServer* web_server, guint max_header_bytes);
+  G_GNUC_INTERNAL void web_server_set_max_header_count (WebServer* web_server, guint max_header_count);
+  G_GNUC_INTERNAL void web_server_set_max_header_length (WebServer* web_server, guint max_header_length);
+  G_GNUC_INTERNAL void web_server_set_max_pipelined (WebServer* web_server, guint max_pipelined);
+  G_GNUC_INTERNAL void web_server_set_max_request_line (WebServer* web_server, guint max_request_line);
+  G_GNUC_INTERNAL void web_server_set_max_requests (WebServer* web_server, guint max_requests);
+  G_GNUC_INTERNAL void web_server_set_shed_connections (WebServer* web_server, gboolean shed_connections);
   G_GNUC_INTERNAL void web_server_listen (WebServer* web_server, GSocketAddress* address, WebListenOptions options, GError** error);
   G_GNUC_INTERNAL void web_server_listen_any (WebServer* web_server, guint16 port, WebListenOptions options, GError** error);
 
@@ -56,6 +56,7 @@ G_DEFINE_ENUM_TYPE
     G_DEFINE_ENUM_VALUE (WEB_STATUS_CODE_MISDIRECTED_REQUEST, "Misdirected Request"),
     G_DEFINE_ENUM_VALUE (WEB_STATUS_CODE_UNPROCESSABLE_CONTENT, "Unprocessable Content"),
     G_DEFINE_ENUM_VALUE (WEB_STATUS_CODE_UPGRADE_REQUIRED, "Upgrade Required"),
+    G_DEFINE_ENUM_VALUE (WEB_STATUS_CODE_REQUEST_HEADER_FIELDS_TOO_LARGE, "Request Header Fields Too Large"),
     G_DEFINE_ENUM_VALUE (WEB_STATUS_CODE_INTERNAL_SERVER_ERROR, "Internal Server Error"),
     G_DEFINE_ENUM_VALUE (WEB_STATUS_CODE_NOT_IMPLEMENTED, "Not Implemented"),
     G_DEFINE_ENUM_VALUE (WEB_STATUS_CODE_BAD_GATEWAY, "Bad Gateway"),
@@ -66,8 +67,19 @@ G_DEFINE_ENUM_TYPE
 
 const gchar* web_status_code_get_inline (WebStatusCode status_code)
 {
-  GEnumClass* klass = g_type_class_ref (WEB_TYPE_STATUS_CODE);
-  GEnumValue* value = g_enum_get_value (klass, (gint) status_code);
-  const gchar* nick = g_intern_string (value->value_nick);
-return (g_type_class_unref (klass), nick);
+  static const gchar* reasons [WEB_STATUS_CODE_MAX] = {0};
+  static gsize __value__ = 0;
+
+  /* the enum class is walked once, its nicks live for as long
+   * as the class does, which is kept referenced from then on */
+  if (g_once_init_enter (&__value__))
+    {
+      GEnumClass* klass = g_type_class_ref (WEB_TYPE_STATUS_CODE);
+      guint i;
+
+      for (i = 0; i < klass->n_values; ++i)
+        reasons [klass->values [i].value] = klass->values [i].value_nick;
+      g_once_init_leave (&__value__, 1);
+    }
+return ((guint) status_code < WEB_STATUS_CODE_MAX) ? reasons [status_code] : NULL;
 }
@@ -19,6 +19,7 @@
 #include <glib-object.h>
 
 #define WEB_TYPE_STATUS_CODE (web_status_code_get_type ())
+#define WEB_STATUS_CODE_MAX (600)
 
 #if __cplusplus
 extern "C" {
@@ -63,6 +64,7 @@ extern "C" {
     WEB_STATUS_CODE_MISDIRECTED_REQUEST = 421,
     WEB_STATUS_CODE_UNPROCESSABLE_CONTENT = 422,
     WEB_STATUS_CODE_UPGRADE_REQUIRED = 426,
+    WEB_STATUS_CODE_REQUEST_HEADER_FIELDS_TOO_LARGE = 431,
     WEB_STATUS_CODE_INTERNAL_SERVER_ERROR = 500,
     WEB_STATUS_CODE_NOT_IMPLEMENTED = 501,
     WEB_STATUS_CODE_BAD_GATEWAY = 502,
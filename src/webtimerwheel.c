@@ -0,0 +1,311 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <webtimerwheel.h>
+
+typedef struct _WebTimerWheelSource WebTimerWheelSource;
+static void web_timer_wheel_free (WebTimerWheel* web_timer_wheel);
+#define SLOT_BITS (6)
+#define SLOT_COUNT (1 << SLOT_BITS)
+#define SLOT_MASK (SLOT_COUNT - 1)
+#define TICK_BITS (16)
+#define WHEEL_LEVELS (4)
+
+/* Deadlines are kept in ticks of 2^TICK_BITS microseconds (~65ms) on a
+ * hierarchical wheel: level N slots span SLOT_COUNT^N ticks and are
+ * cascaded into the level below whenever it wraps around, so arming
+ * and cancelling are O(1) and expiry only touches due timers */
+
+struct _WebTimerWheel
+{
+  GQueue expired;
+  guint n_timers;
+  guint64 now;
+  guint64 occupied [WHEEL_LEVELS];
+  gint64 ready_time;
+  GQueue slots [WHEEL_LEVELS] [SLOT_COUNT];
+  GSource* source;
+};
+
+struct _WebTimerWheelSource
+{
+  GSource parent;
+  WebTimerWheel* web_timer_wheel;
+};
+
+static GPrivate wheel_private = G_PRIVATE_INIT ((GDestroyNotify) web_timer_wheel_free);
+
+static void cascade (WebTimerWheel* self, guint level, guint index);
+static void insert (WebTimerWheel* self, WebTimer* timer);
+static guint lowest_bit (guint64 mask);
+
+static void cascade (WebTimerWheel* self, guint level, guint index)
+{
+  GQueue moved = self->slots [level] [index];
+  GList* link = NULL;
+
+  g_queue_init (& self->slots [level] [index]);
+  self->occupied [level] &= ~(G_GUINT64_CONSTANT (1) << index);
+
+  while ((link = g_queue_pop_head_link (& moved)) != NULL)
+    insert (self, link->data);
+}
+
+static void detach (WebTimerWheel* self, WebTimer* timer)
+{
+  GQueue* slot = timer->slot;
+  gsize offset;
+
+  g_queue_unlink (slot, & timer->link);
+
+  if (slot != & self->expired && g_queue_is_empty (slot))
+    {
+      offset = slot - & self->slots [0] [0];
+      self->occupied [offset / SLOT_COUNT] &= ~(G_GUINT64_CONSTANT (1) << (offset % SLOT_COUNT));
+    }
+
+  timer->slot = NULL;
+  timer->wheel = NULL;
+  self->n_timers -= 1;
+}
+
+static void insert (WebTimerWheel* self, WebTimer* timer)
+{
+  guint64 expires = MAX (timer->expires, self->now);
+  guint64 delta = expires - self->now;
+  guint index, level;
+
+  for (level = 0; level < WHEEL_LEVELS - 1; ++level)
+    {
+      if (delta < (G_GUINT64_CONSTANT (1) << (SLOT_BITS * (level + 1))))
+        break;
+    }
+
+  /* anything further away than the wheel spans waits in the top level
+   * and gets re-inserted (with its real expiry) when cascaded */
+  if (delta >= (G_GUINT64_CONSTANT (1) << (SLOT_BITS * WHEEL_LEVELS)))
+    expires = self->now + (G_GUINT64_CONSTANT (1) << (SLOT_BITS * WHEEL_LEVELS)) - 1;
+
+  index = (guint) ((expires >> (SLOT_BITS * level)) & SLOT_MASK);
+  timer->slot = & self->slots [level] [index];
+  timer->wheel = self;
+
+  g_queue_push_tail_link (timer->slot, & timer->link);
+  self->occupied [level] |= G_GUINT64_CONSTANT (1) << index;
+}
+
+static guint lowest_bit (guint64 mask)
+{
+  /* g_bit_nth_lsf () takes a gulong, which may be only 32 bits wide */
+#if GLIB_SIZEOF_LONG == 8
+  return g_bit_nth_lsf ((gulong) mask, -1);
+#else // GLIB_SIZEOF_LONG
+  if ((guint32) mask != 0)
+    return g_bit_nth_lsf ((gulong) (guint32) mask, -1);
+  return 32 + g_bit_nth_lsf ((gulong) (mask >> 32), -1);
+#endif // GLIB_SIZEOF_LONG
+}
+
+static gint64 next_ready_time (WebTimerWheel* self)
+{
+  guint64 pending, tick;
+
+  if (self->n_timers == 0)
+    return -1;
+
+  /* the first occupied level 0 slot from now on, or the next wrap
+   * around, where the upper levels get cascaded down */
+  if ((pending = self->occupied [0] >> (self->now & SLOT_MASK)) != 0)
+    tick = self->now + lowest_bit (pending);
+  else
+    tick = (self->now | SLOT_MASK) + 1;
+return (gint64) (tick << TICK_BITS);
+}
+
+static void run (WebTimerWheel* self, guint64 tick)
+{
+  WebTimer* timer = NULL;
+  GList* link = NULL;
+  guint index, level, slot;
+
+  while (self->now <= tick)
+    {
+      if (self->n_timers == 0)
+        {
+          self->now = tick + 1;
+          break;
+        }
+
+      if ((index = (guint) (self->now & SLOT_MASK)) == 0)
+        {
+          for (level = 1; level < WHEEL_LEVELS; ++level)
+            {
+              cascade (self, level, (slot = (guint) ((self->now >> (SLOT_BITS * level)) & SLOT_MASK)));
+
+              if (slot != 0)
+                break;
+            }
+        }
+      else if (self->occupied [0] == 0)
+        {
+          /* nothing due before the next cascade */
+          self->now = MIN (tick + 1, (self->now | SLOT_MASK) + 1);
+          continue;
+        }
+
+      /* due timers are moved aside first, so callbacks re-arming
+       * them never land back in the slot being expired */
+      self->expired = self->slots [0] [index];
+      self->now += 1;
+
+      g_queue_init (& self->slots [0] [index]);
+      self->occupied [0] &= ~(G_GUINT64_CONSTANT (1) << index);
+
+      for (link = self->expired.head; link; link = link->next)
+        ((WebTimer*) link->data)->slot = & self->expired;
+
+      while ((link = g_queue_peek_head_link (& self->expired)) != NULL)
+        {
+          detach (self, (timer = link->data));
+          timer->callback (timer->user_data);
+        }
+    }
+}
+
+static gboolean web_timer_wheel_source_dispatch (GSource* pself, GSourceFunc callback, gpointer user_data)
+{
+  WebTimerWheel* self = ((WebTimerWheelSource*) pself)->web_timer_wheel;
+
+  run (self, (guint64) g_source_get_time (pself) >> TICK_BITS);
+  g_source_set_ready_time (pself, (self->ready_time = next_ready_time (self)));
+return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs web_timer_wheel_source_funcs =
+{
+  .dispatch = web_timer_wheel_source_dispatch,
+};
+
+static WebTimerWheel* web_timer_wheel_new (void)
+{
+  WebTimerWheel* self = g_slice_new0 (WebTimerWheel);
+  WebTimerWheelSource* source = NULL;
+  guint index, level;
+
+  for (level = 0; level < WHEEL_LEVELS; ++level)
+  for (index = 0; index < SLOT_COUNT; ++index)
+    g_queue_init (& self->slots [level] [index]);
+
+  g_queue_init (& self->expired);
+
+  self->now = (guint64) g_get_monotonic_time () >> TICK_BITS;
+  self->ready_time = -1;
+
+  source = (gpointer) g_source_new (& web_timer_wheel_source_funcs, sizeof (WebTimerWheelSource));
+  source->web_timer_wheel = self;
+
+  g_source_set_priority ((GSource*) source, G_PRIORITY_DEFAULT);
+#if GLIB_CHECK_VERSION(2, 70, 0)
+  g_source_set_static_name ((GSource*) source, "[WebTimerWheel.Source]");
+#else // GLIB_CHECK_VERSION(2, 70, 0)
+  g_source_set_name ((GSource*) source, "[WebTimerWheel.Source]");
+#endif // GLIB_CHECK_VERSION(2, 70, 0)
+  g_source_attach ((self->source = (GSource*) source), g_main_context_get_thread_default ());
+return self;
+}
+
+static void web_timer_wheel_free (WebTimerWheel* web_timer_wheel)
+{
+  WebTimerWheel* self = (web_timer_wheel);
+  GList* link = NULL;
+  guint index, level;
+
+  g_source_destroy (self->source);
+  g_source_unref (self->source);
+
+  /* timers still armed outlive the worker, they are only
+   * unhooked here so a later web_timer_cancel() is a no-op */
+  for (level = 0; level < WHEEL_LEVELS; ++level)
+  for (index = 0; index < SLOT_COUNT; ++index)
+    {
+      while ((link = g_queue_peek_head_link (& self->slots [level] [index])) != NULL)
+        detach (self, link->data);
+    }
+
+  g_slice_free (WebTimerWheel, self);
+}
+
+void web_timer_cancel (WebTimer* timer)
+{
+  g_return_if_fail (timer != NULL);
+
+  if (timer->wheel != NULL)
+    detach (timer->wheel, timer);
+}
+
+void web_timer_init (WebTimer* timer, WebTimerCallback callback, gpointer user_data)
+{
+  g_return_if_fail (timer != NULL);
+  g_return_if_fail (callback != NULL);
+
+  timer->callback = callback;
+  timer->expires = 0;
+  timer->link.data = timer;
+  timer->link.next = NULL;
+  timer->link.prev = NULL;
+  timer->slot = NULL;
+  timer->user_data = user_data;
+  timer->wheel = NULL;
+}
+
+void web_timer_wheel_arm (WebTimerWheel* web_timer_wheel, WebTimer* timer, gint64 deadline)
+{
+  g_return_if_fail (web_timer_wheel != NULL);
+  g_return_if_fail (timer != NULL);
+  WebTimerWheel* self = (web_timer_wheel);
+  guint64 expires;
+  gint64 ready_time;
+
+  /* rounded up, a timer never fires before its deadline */
+  expires = ((guint64) MAX (0, deadline) + ((1 << TICK_BITS) - 1)) >> TICK_BITS;
+
+  if (timer->wheel == self && timer->expires == expires)
+    return;
+  else
+    {
+      if (timer->wheel != NULL)
+        detach (timer->wheel, timer);
+
+      timer->expires = expires;
+      insert (self, timer);
+      self->n_timers += 1;
+
+      ready_time = (gint64) (MAX (expires, self->now) << TICK_BITS);
+
+      if (self->ready_time < 0 || self->ready_time > ready_time)
+        g_source_set_ready_time (self->source, (self->ready_time = ready_time));
+    }
+}
+
+WebTimerWheel* web_timer_wheel_get_thread_default (void)
+{
+  WebTimerWheel* web_timer_wheel = NULL;
+
+  if ((web_timer_wheel = g_private_get (& wheel_private)) == NULL)
+    g_private_set (& wheel_private, (web_timer_wheel = web_timer_wheel_new ()));
+return web_timer_wheel;
+}
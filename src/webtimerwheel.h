@@ -0,0 +1,48 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of WebServer.
+ *
+ * WebServer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebServer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebServer. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __WEB_TIMER_WHEEL__
+#define __WEB_TIMER_WHEEL__ 1
+#include <glib.h>
+
+typedef struct _WebTimer WebTimer;
+typedef struct _WebTimerWheel WebTimerWheel;
+typedef void (*WebTimerCallback) (gpointer user_data);
+
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  struct _WebTimer
+  {
+    WebTimerCallback callback;
+    guint64 expires;
+    GList link;
+    GQueue* slot;
+    gpointer user_data;
+    WebTimerWheel* wheel;
+  };
+
+  G_GNUC_INTERNAL void web_timer_cancel (WebTimer* timer);
+  G_GNUC_INTERNAL void web_timer_init (WebTimer* timer, WebTimerCallback callback, gpointer user_data);
+  G_GNUC_INTERNAL void web_timer_wheel_arm (WebTimerWheel* web_timer_wheel, WebTimer* timer, gint64 deadline);
+  G_GNUC_INTERNAL WebTimerWheel* web_timer_wheel_get_thread_default (void);
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
+#endif // __WEB_TIMER_WHEEL__